@@ -0,0 +1,137 @@
+#include <limits>
+#include <string>
+
+#include "acceleration_structure.h"
+#include "kd_tree.h"
+#include "bvh.h"
+#include "instance.h"
+
+ray_tracing::Acceleration_structure::Acceleration_structure(const char* name,
+                                                           const std::vector<std::shared_ptr<Primitive>>& primitives)
+    : elements(primitives),
+      statistics()
+{
+    statistics.name = name;
+}
+
+ray_tracing::Hit ray_tracing::Acceleration_structure::trace(const Ray& ray) const
+{
+    Intersection closest = traverse(ray, std::numeric_limits<double>::max(), false);
+
+    if(closest.coefficient == Ray::NOWHERE)
+        return Hit();
+
+    return elements.hit(closest, ray);
+}
+
+std::array<ray_tracing::Hit, ray_tracing::Ray_packet::SIZE>
+    ray_tracing::Acceleration_structure::trace(const Ray_packet& packet) const
+{
+    std::array<Intersection, Ray_packet::SIZE> closest;
+    traverse(packet, closest);
+
+    std::array<Hit, Ray_packet::SIZE> result;
+
+    for(size_t i = 0; i < packet.size; ++i)
+    {
+        if(closest[i].coefficient == Ray::NOWHERE)
+            continue;
+
+        result[i] = elements.hit(closest[i], packet.rays[i]);
+    }
+
+    return result;
+}
+
+void ray_tracing::Acceleration_structure::traverse(const Ray_packet& packet,
+                                                   std::array<Intersection, Ray_packet::SIZE>& result) const
+{
+    for(size_t i = 0; i < packet.size; ++i)
+        result[i] = traverse(packet.rays[i], std::numeric_limits<double>::max(), false);
+}
+
+double ray_tracing::Acceleration_structure::intersect(const Ray& ray) const
+{
+    return traverse(ray, std::numeric_limits<double>::max(), false).coefficient;
+}
+
+bool ray_tracing::Acceleration_structure::occluded(const Ray& ray, double max_coefficient) const
+{
+    return traverse(ray, max_coefficient, true).coefficient != Ray::NOWHERE;
+}
+
+//split planes can't be refit
+bool ray_tracing::Acceleration_structure::refit(const std::vector<std::shared_ptr<Primitive>>&)
+{
+    return false;
+}
+
+void ray_tracing::Acceleration_structure::save_statistics(Cache_writer& writer) const
+{
+    writer.write(statistics.build_time);
+
+    for(size_t value : {statistics.primitives_num,
+                        statistics.nodes_num,
+                        statistics.leaves_num,
+                        statistics.references_num,
+                        statistics.depth})
+        writer.write<uint64_t>(value);
+}
+
+void ray_tracing::Acceleration_structure::load_statistics(Cache_reader& reader)
+{
+    reader.read(statistics.build_time);
+
+    for(size_t* value : {&statistics.primitives_num,
+                         &statistics.nodes_num,
+                         &statistics.leaves_num,
+                         &statistics.references_num,
+                         &statistics.depth})
+    {
+        uint64_t x;
+        reader.read(x);
+        *value = x;
+    }
+}
+
+void ray_tracing::write_json(std::ostream& stream, const Acceleration_structure::Statistics& statistics, size_t indent)
+{
+    std::string outer(indent, ' '), inner(indent + 4, ' ');
+
+    stream << "{" << std::endl
+           << inner << "\"name\": \"" << statistics.name << "\"," << std::endl
+           << inner << "\"build_time\": " << statistics.build_time << "," << std::endl
+           << inner << "\"primitives\": " << statistics.primitives_num << "," << std::endl
+           << inner << "\"references\": " << statistics.references_num << "," << std::endl
+           << inner << "\"nodes\": " << statistics.nodes_num << "," << std::endl
+           << inner << "\"leaves\": " << statistics.leaves_num << "," << std::endl
+           << inner << "\"depth\": " << statistics.depth << std::endl
+           << outer << "}";
+}
+
+std::unique_ptr<ray_tracing::Acceleration_structure>
+    ray_tracing::build_acceleration_structure(Acceleration acceleration,
+                                              const std::vector<std::shared_ptr<Primitive>>& primitives,
+                                              Thread_pool& pool)
+{
+    //groups are built before the instances are bounded, once for all their instances
+    for(const std::shared_ptr<Primitive>& primitive : primitives)
+        if(const Instance* instance = dynamic_cast<const Instance*>(primitive.get()))
+            instance->get_group().build(acceleration, pool);
+
+    if(acceleration == Acceleration::BVH)
+        return std::unique_ptr<Acceleration_structure>(new Bvh(primitives));
+    else
+        return std::unique_ptr<Acceleration_structure>(new Kd_tree(primitives, pool));
+}
+
+std::unique_ptr<ray_tracing::Acceleration_structure>
+    ray_tracing::load_acceleration_structure(Acceleration acceleration,
+                                             const std::vector<std::shared_ptr<Primitive>>& primitives,
+                                             Cache_reader& reader)
+{
+    if(acceleration == Acceleration::BVH)
+        return std::unique_ptr<Acceleration_structure>(new Bvh(primitives, reader));
+    else
+        return std::unique_ptr<Acceleration_structure>(new Kd_tree(primitives, reader));
+}
@@ -0,0 +1,92 @@
+#ifndef ACCELERATION_STRUCTURE
+#define ACCELERATION_STRUCTURE
+
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include "primitive.h"
+#include "primitive_arrays.h"
+#include "geometry.h"
+#include "packet.h"
+#include "thread_pool.h"
+#include "cache_io.h"
+#include "render_statistics.h"
+
+namespace ray_tracing
+{
+
+enum class Acceleration {KD_TREE, BVH};
+
+class Acceleration_structure
+{
+public:
+    struct Statistics
+    {
+        const char* name;
+        double build_time;
+        size_t primitives_num, nodes_num, leaves_num, references_num, depth;
+    };
+
+protected:
+    //nodes reference elements by their indices
+    Primitive_arrays elements;
+
+    Statistics statistics;
+
+    //returns the closest intersection nearer than max_coefficient, or any if any_hit is set
+    virtual Intersection traverse(const Ray& ray, double max_coefficient, bool any_hit) const = 0;
+    //closest intersections for the rays of the packet, traced one by one unless overridden
+    virtual void traverse(const Ray_packet& packet, std::array<Intersection, Ray_packet::SIZE>& result) const;
+
+    void save_statistics(Cache_writer& writer) const;
+    void load_statistics(Cache_reader& reader);
+
+public:
+    Acceleration_structure(const char* name, const std::vector<std::shared_ptr<Primitive>>& primitives);
+
+    //hit.primitive is nullptr if the ray hits nothing
+    Hit trace(const Ray& ray) const;
+    std::array<Hit, Ray_packet::SIZE> trace(const Ray_packet& packet) const;
+    //coefficient of the closest intersection or Ray::NOWHERE, the hit isn't filled
+    double intersect(const Ray& ray) const;
+    //whether anything intersects the ray before max_coefficient, stops at the first intersection found
+    bool occluded(const Ray& ray, double max_coefficient) const;
+    //the intersection found by traverse and the hit filled for it, for a structure traversed within another one
+    Intersection find(const Ray& ray, double max_coefficient, bool any_hit) const
+    {
+        return traverse(ray, max_coefficient, any_hit);
+    }
+    Hit hit(const Intersection& intersection, const Ray& ray) const
+    {
+        return elements.hit(intersection, ray);
+    }
+    const Statistics& get_statistics() const
+    {
+        return statistics;
+    }
+    //the structure is read back by load_acceleration_structure
+    virtual void save(Cache_writer& writer) const = 0;
+    //takes primitives moved or deformed in place of the ones it was built of, keeping the structure and
+    //recomputing its bounds. Returns false if it can't be refit, then it is to be built again
+    virtual bool refit(const std::vector<std::shared_ptr<Primitive>>& primitives);
+
+    virtual ~Acceleration_structure() = default;
+};
+
+//writes the statistics as a JSON object, nested lines are indented by indent spaces
+void write_json(std::ostream& stream, const Acceleration_structure::Statistics& statistics, size_t indent = 0);
+
+std::unique_ptr<Acceleration_structure>
+    build_acceleration_structure(Acceleration acceleration,
+                                 const std::vector<std::shared_ptr<Primitive>>& primitives,
+                                 Thread_pool& pool);
+//throws std::runtime_error if the saved structure is corrupted or doesn't fit the primitives
+std::unique_ptr<Acceleration_structure>
+    load_acceleration_structure(Acceleration acceleration,
+                                const std::vector<std::shared_ptr<Primitive>>& primitives,
+                                Cache_reader& reader);
+
+}
+
+#endif // ACCELERATION_STRUCTURE
@@ -0,0 +1,556 @@
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "primitive.h"
+
+//bounds are stored in single precision, so they are rounded outwards
+float round_down(double x)
+{
+    float result = x;
+    return result > x ? std::nextafter(result, -std::numeric_limits<float>::infinity()) : result;
+}
+
+float round_up(double x)
+{
+    float result = x;
+    return result < x ? std::nextafter(result, std::numeric_limits<float>::infinity()) : result;
+}
+
+ray_tracing::Bvh::Bvh(const std::vector<std::shared_ptr<Primitive>>& primitives)
+    : Acceleration_structure("bvh", primitives),
+      primitive_indices(elements.size()),
+      box(Point::MAX, -Point::MAX)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<Box> bounds;
+    std::vector<Point> centroids;
+
+    for(uint32_t i = 0; i < elements.size(); ++i)
+    {
+        bounds.push_back(elements.bounds(i));
+        centroids.push_back((bounds.back().ld + bounds.back().ru) / 2);
+        box.extend(bounds.back());
+    }
+
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0);
+
+    if(elements.size() != 0)
+    {
+        std::vector<Binary_node> binary_nodes;
+        binary_nodes.reserve(2 * elements.size());
+
+        collapse(binary_nodes, build(binary_nodes, bounds, centroids, 0, elements.size(), 0), 1);
+    }
+
+    //leaves sorted by element indices are tested by runs of a single type
+    for(const Bvh_node& node : nodes)
+        for(size_t k = 0; k < node.children_num; ++k)
+            if(node.sizes[k] != 0)
+                std::sort(primitive_indices.begin() + node.children[k],
+                          primitive_indices.begin() + node.children[k] + node.sizes[k]);
+
+    statistics.build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    statistics.primitives_num = elements.size();
+    statistics.nodes_num = nodes.size();
+    statistics.references_num = primitive_indices.size();
+}
+
+ray_tracing::Bvh::Bvh(const std::vector<std::shared_ptr<Primitive>>& primitives, Cache_reader& reader)
+    : Acceleration_structure("bvh", primitives)
+{
+    reader.read(box);
+    reader.read(nodes);
+    reader.read(primitive_indices);
+    load_statistics(reader);
+
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        if(nodes[i].children_num > Bvh_node::WIDTH)
+            throw std::runtime_error("corrupted bvh");
+
+        for(size_t k = 0; k < nodes[i].children_num; ++k)
+            if(nodes[i].sizes[k] == 0 ? nodes[i].children[k] <= i || nodes[i].children[k] >= nodes.size() :
+                                        size_t(nodes[i].children[k]) + nodes[i].sizes[k] > primitive_indices.size())
+                throw std::runtime_error("corrupted bvh");
+    }
+
+    for(uint32_t index : primitive_indices)
+        if(index >= elements.size())
+            throw std::runtime_error("corrupted bvh");
+}
+
+void ray_tracing::Bvh::save(Cache_writer& writer) const
+{
+    writer.write(box);
+    writer.write(nodes);
+    writer.write(primitive_indices);
+    save_statistics(writer);
+}
+
+//children are stored after their parents, so nodes are refit in the reverse order
+bool ray_tracing::Bvh::refit(const std::vector<std::shared_ptr<Primitive>>& primitives)
+{
+    Primitive_arrays refitted(primitives);
+
+    if(!refitted.matches(elements))
+        return false;
+
+    elements = std::move(refitted);
+
+    std::vector<Box> node_boxes(nodes.size(), Box(Point::MAX, -Point::MAX));
+
+    for(size_t i = nodes.size(); i-- > 0;)
+    {
+        Bvh_node& node = nodes[i];
+
+        for(size_t k = 0; k < node.children_num; ++k)
+        {
+            Box child(Point::MAX, -Point::MAX);
+
+            if(node.sizes[k] == 0)
+                child = node_boxes[node.children[k]];
+            else
+                for(uint32_t j = node.children[k]; j < node.children[k] + node.sizes[k]; ++j)
+                    child.extend(elements.bounds(primitive_indices[j]));
+
+            for(size_t axis = 0; axis < Point::AXIS_SIZE; ++axis)
+            {
+                node.ld[axis][k] = round_down(child.ld[axis]);
+                node.ru[axis][k] = round_up(child.ru[axis]);
+            }
+
+            node_boxes[i].extend(child);
+        }
+    }
+
+    box = nodes.empty() ? Box(Point::MAX, -Point::MAX) : node_boxes[0];
+
+    return true;
+}
+
+uint32_t ray_tracing::Bvh::build(std::vector<Binary_node>& binary_nodes,
+                                 const std::vector<Box>& bounds,
+                                 const std::vector<Point>& centroids,
+                                 uint32_t from, uint32_t to,
+                                 size_t depth)
+{
+    Box node_box(Point::MAX, -Point::MAX), centroids_box(Point::MAX, -Point::MAX);
+
+    for(uint32_t i = from; i < to; ++i)
+    {
+        node_box.extend(bounds[primitive_indices[i]]);
+        centroids_box.extend(centroids[primitive_indices[i]]);
+    }
+
+    uint32_t size = to - from;
+    uint32_t node = binary_nodes.size();
+    binary_nodes.push_back(Binary_node{node_box, {0, 0}, from, size});
+
+    if(size <= LEAF_SIZE || depth >= MAX_DEPTH)
+        return node;
+
+    Point::Axis best_axis = Point::X;
+    size_t best_bin = 0;
+    double best_cost = std::numeric_limits<double>::max(),
+           surface_area = node_box.surface_area();
+
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+    {
+        double  bins_from = centroids_box.ld[i],
+                width = centroids_box.ru[i] - bins_from;
+
+        if(width <= 0)
+            continue;
+
+        std::array<size_t, BINS_NUM> counts{};
+        std::array<Box, BINS_NUM> boxes;
+        boxes.fill(Box(Point::MAX, -Point::MAX));
+
+        for(uint32_t j = from; j < to; ++j)
+        {
+            size_t bin = std::min(BINS_NUM - 1,
+                                  size_t((centroids[primitive_indices[j]][i] - bins_from) / width * BINS_NUM));
+
+            ++counts[bin];
+            boxes[bin].extend(bounds[primitive_indices[j]]);
+        }
+
+        //cost of everything to the right of each bin border
+        std::array<double, BINS_NUM> right_costs;
+        Box right_box(Point::MAX, -Point::MAX);
+        size_t right_num = 0;
+
+        for(size_t j = BINS_NUM - 1; j > 0; --j)
+        {
+            right_box.extend(boxes[j]);
+            right_num += counts[j];
+            right_costs[j] = right_num == 0 ? 0 : right_num * right_box.surface_area();
+        }
+
+        Box left_box(Point::MAX, -Point::MAX);
+        size_t left_num = 0;
+
+        for(size_t j = 1; j < BINS_NUM; ++j)
+        {
+            left_box.extend(boxes[j - 1]);
+            left_num += counts[j - 1];
+
+            if(left_num == 0 || left_num == size)
+                continue;
+
+            double cost = TRAVERSAL_COST +
+                          INTERSECTION_COST * (left_num * left_box.surface_area() + right_costs[j]) / surface_area;
+
+            if(cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = Point::Axis(i);
+                best_bin = j;
+            }
+        }
+    }
+
+    if(best_cost >= INTERSECTION_COST * size && size <= MAX_LEAF_SIZE)
+        return node;
+
+    uint32_t middle;
+
+    if(best_cost == std::numeric_limits<double>::max())
+    {
+        //all the centroids coincide, so any split is as good as the others
+        middle = from + size / 2;
+    }
+    else
+    {
+        double  bins_from = centroids_box.ld[best_axis],
+                width = centroids_box.ru[best_axis] - bins_from;
+
+        middle = std::partition(primitive_indices.begin() + from,
+                                primitive_indices.begin() + to,
+                                [&](uint32_t index)
+                                {
+                                    return std::min(BINS_NUM - 1,
+                                                    size_t((centroids[index][best_axis] - bins_from) /
+                                                           width * BINS_NUM)) < best_bin;
+                                }) - primitive_indices.begin();
+    }
+
+    uint32_t left = build(binary_nodes, bounds, centroids, from, middle, depth + 1);
+    uint32_t right = build(binary_nodes, bounds, centroids, middle, to, depth + 1);
+
+    binary_nodes[node].children = {left, right};
+
+    return node;
+}
+
+uint32_t ray_tracing::Bvh::collapse(const std::vector<Binary_node>& binary_nodes,
+                                    uint32_t binary_node,
+                                    size_t depth)
+{
+    auto is_leaf = [&binary_nodes](uint32_t index)
+                   {
+                       return binary_nodes[index].children[0] == binary_nodes[index].children[1];
+                   };
+
+    std::vector<uint32_t> children;
+
+    if(is_leaf(binary_node))
+        children.push_back(binary_node);
+    else
+        children.assign(binary_nodes[binary_node].children.begin(), binary_nodes[binary_node].children.end());
+
+    //the biggest interior children are replaced by their own children until the node is full
+    while(children.size() < Bvh_node::WIDTH)
+    {
+        std::vector<uint32_t>::iterator biggest = children.end();
+
+        for(std::vector<uint32_t>::iterator i = children.begin(); i != children.end(); ++i)
+            if(!is_leaf(*i) &&
+               (biggest == children.end() ||
+                binary_nodes[*i].box.surface_area() > binary_nodes[*biggest].box.surface_area()))
+                biggest = i;
+
+        if(biggest == children.end())
+            break;
+
+        std::array<uint32_t, 2> grandchildren = binary_nodes[*biggest].children;
+        *biggest = grandchildren[1];
+        children.insert(biggest, grandchildren[0]);
+    }
+
+    uint32_t node = nodes.size();
+    nodes.push_back(Bvh_node());
+    nodes[node].children_num = children.size();
+
+    statistics.depth = std::max(statistics.depth, depth);
+
+    for(size_t k = 0; k < children.size(); ++k)
+    {
+        const Binary_node& child = binary_nodes[children[k]];
+
+        for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+        {
+            nodes[node].ld[i][k] = round_down(child.box.ld[i]);
+            nodes[node].ru[i][k] = round_up(child.box.ru[i]);
+        }
+
+        if(is_leaf(children[k]))
+        {
+            ++statistics.leaves_num;
+            nodes[node].children[k] = child.offset;
+            nodes[node].sizes[k] = child.size;
+        }
+        else
+        {
+            uint32_t child_node = collapse(binary_nodes, children[k], depth + 1);
+            nodes[node].children[k] = child_node;
+            nodes[node].sizes[k] = 0;
+        }
+    }
+
+    return node;
+}
+
+void ray_tracing::Bvh::traverse(const Ray& ray,
+                                const Todo& start,
+                                double& limit,
+                                Intersection& result,
+                                bool any_hit,
+                                Render_statistics* counters) const
+{
+    std::array<Todo, STACK_SIZE> todo;
+    size_t todo_size = 0;
+
+    Point guiding = ray.guiding();
+    std::array<double, Point::AXIS_SIZE> inverse;
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+        inverse[i] = 1 / guiding[i];
+
+    todo[todo_size++] = start;
+
+    while(todo_size != 0)
+    {
+        Todo current = todo[--todo_size];
+
+        if(current.from > limit)
+            continue;
+
+        if(current.size != 0)
+        {
+            if(counters)
+                counters->count_leaf(elements,
+                                     primitive_indices.data() + current.index,
+                                     primitive_indices.data() + current.index + current.size);
+
+            if(elements.intersect(ray,
+                                  primitive_indices.data() + current.index,
+                                  primitive_indices.data() + current.index + current.size,
+                                  any_hit,
+                                  limit,
+                                  result) && any_hit)
+                return;
+
+            continue;
+        }
+
+        const Bvh_node& node = nodes[current.index];
+
+        if(counters)
+            ++counters->nodes_visited;
+
+        //NaNs coming from rays parallel to a slab are dropped by std::min and std::max
+        std::array<double, Bvh_node::WIDTH> from, to;
+        for(size_t k = 0; k < Bvh_node::WIDTH; ++k)
+        {
+            from[k] = 0;
+            to[k] = limit;
+
+            for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+            {
+                double  ld = (node.ld[i][k] - ray.begin[i]) * inverse[i],
+                        ru = (node.ru[i][k] - ray.begin[i]) * inverse[i];
+
+                from[k] = std::max(from[k], std::min(ld, ru));
+                to[k] = std::min(to[k], std::max(ld, ru));
+            }
+        }
+
+        //hit children are pushed farthest first, so the nearest one is popped next
+        size_t pushed_from = todo_size;
+
+        for(size_t k = 0; k < node.children_num; ++k)
+        {
+            if(from[k] > to[k])
+                continue;
+
+            size_t position = todo_size++;
+            for(; position > pushed_from && todo[position - 1].from < from[k]; --position)
+                todo[position] = todo[position - 1];
+
+            todo[position] = Todo{node.children[k], node.sizes[k], from[k]};
+        }
+    }
+}
+
+ray_tracing::Intersection ray_tracing::Bvh::traverse(const Ray& ray,
+                                                     double max_coefficient,
+                                                     bool any_hit) const
+{
+    //loaded once, so that traversals not counted only pay for a few predictable branches
+    Render_statistics* counters = thread_statistics;
+    if(counters)
+        ++counters->traversals;
+
+    Intersection result{Ray::NOWHERE, 0, 0};
+
+    if(nodes.empty())
+        return result;
+
+    std::array<double, 2> range = clip(ray, box);
+    if(range[0] == Ray::NOWHERE || range[0] > max_coefficient)
+        return result;
+
+    //intersections farther than limit are of no interest
+    double limit = max_coefficient;
+
+    traverse(ray, Todo{0, 0, range[0]}, limit, result, any_hit, counters);
+
+    return result;
+}
+
+void ray_tracing::Bvh::traverse(const Ray_packet& packet,
+                                std::array<Intersection, Ray_packet::SIZE>& result) const
+{
+    Render_statistics* counters = thread_statistics;
+    if(counters)
+        counters->traversals += packet.size;
+
+    result.fill(Intersection{Ray::NOWHERE, 0, 0});
+
+    if(nodes.empty())
+        return;
+
+    //lanes out of use and rays missing the scene get a negative limit, which no box or primitive passes
+    Ray_packet::Lanes limit;
+    double packet_from = std::numeric_limits<double>::max();
+    size_t active = 0;
+
+    for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+    {
+        std::array<double, 2> range = i < packet.size ? clip(packet.rays[i], box) :
+                                                        std::array<double, 2>{Ray::NOWHERE, Ray::NOWHERE};
+
+        limit[i] = range[0] == Ray::NOWHERE ? -1 : std::numeric_limits<double>::max();
+
+        if(range[0] != Ray::NOWHERE)
+        {
+            ++active;
+            packet_from = std::min(packet_from, range[0]);
+        }
+    }
+
+    if(active == 0)
+        return;
+
+    std::array<Todo, STACK_SIZE> todo;
+    size_t todo_size = 0;
+
+    todo[todo_size++] = Todo{0, 0, packet_from};
+
+    while(todo_size != 0)
+    {
+        Todo current = todo[--todo_size];
+
+        if(current.from > *std::max_element(limit.begin(), limit.end()))
+            continue;
+
+        if(current.size != 0)
+        {
+            if(counters)
+                counters->count_leaf(elements,
+                                     primitive_indices.data() + current.index,
+                                     primitive_indices.data() + current.index + current.size,
+                                     active);
+
+            elements.intersect(packet,
+                               primitive_indices.data() + current.index,
+                               primitive_indices.data() + current.index + current.size,
+                               limit,
+                               result);
+
+            continue;
+        }
+
+        const Bvh_node& node = nodes[current.index];
+
+        if(counters)
+            ++counters->nodes_visited;
+
+        std::array<Ray_packet::Lanes, Bvh_node::WIDTH> from, to;
+        for(size_t k = 0; k < Bvh_node::WIDTH; ++k)
+        {
+            for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+            {
+                from[k][j] = 0;
+                to[k][j] = limit[j];
+            }
+
+            for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+                for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                {
+                    double  ld = (node.ld[i][k] - packet.begin[i][j]) * packet.inverse[i][j],
+                            ru = (node.ru[i][k] - packet.begin[i][j]) * packet.inverse[i][j];
+
+                    from[k][j] = std::max(from[k][j], std::min(ld, ru));
+                    to[k][j] = std::min(to[k][j], std::max(ld, ru));
+                }
+        }
+
+        size_t pushed_from = todo_size;
+
+        for(size_t k = 0; k < node.children_num; ++k)
+        {
+            size_t hits = 0;
+            double child_from = std::numeric_limits<double>::max();
+
+            for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                if(from[k][j] <= to[k][j])
+                {
+                    ++hits;
+                    child_from = std::min(child_from, from[k][j]);
+                }
+
+            if(hits == 0)
+                continue;
+
+            //the packet diverges here, so the few rays left go on their own
+            if(hits * DIVERGENCE_RATIO < active)
+            {
+                for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                    if(from[k][j] <= to[k][j])
+                        traverse(packet.rays[j],
+                                 Todo{node.children[k], node.sizes[k], from[k][j]},
+                                 limit[j], result[j],
+                                 false,
+                                 counters);
+
+                continue;
+            }
+
+            size_t position = todo_size++;
+            for(; position > pushed_from && todo[position - 1].from < child_from; --position)
+                todo[position] = todo[position - 1];
+
+            todo[position] = Todo{node.children[k], node.sizes[k], child_from};
+        }
+    }
+
+}
@@ -0,0 +1,94 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "acceleration_structure.h"
+#include "primitive.h"
+#include "geometry.h"
+
+namespace ray_tracing
+{
+
+//4-wide node, bounds of the children are stored by coordinate so that they are tested together
+struct Bvh_node
+{
+    static const size_t WIDTH = 4;
+
+    std::array<std::array<float, WIDTH>, Point::AXIS_SIZE> ld, ru;
+    //child node index for interior children, primitives offset for leaves
+    std::array<uint32_t, WIDTH> children;
+    //number of primitives in leaf children, 0 for interior ones
+    std::array<uint32_t, WIDTH> sizes;
+    uint32_t children_num;
+};
+
+class Bvh : public Acceleration_structure
+{
+private:
+    static const size_t BINS_NUM = 32;
+    static const size_t LEAF_SIZE = 4;
+    static const size_t MAX_LEAF_SIZE = 16;
+    //depth of the intermediate binary tree, deeper nodes become leaves
+    static const size_t MAX_DEPTH = 128;
+    static const size_t STACK_SIZE = (Bvh_node::WIDTH - 1) * MAX_DEPTH + 1;
+    constexpr static const double TRAVERSAL_COST = 1;
+    constexpr static const double INTERSECTION_COST = 4;
+    //children hit by less than 1 / DIVERGENCE_RATIO of the packet rays are traversed by single rays
+    static const size_t DIVERGENCE_RATIO = 4;
+
+    //node of the intermediate binary tree, collapsed into 4-wide nodes afterwards
+    struct Binary_node
+    {
+        Box box;
+        std::array<uint32_t, 2> children;
+        uint32_t offset, size;
+    };
+
+    //node or leaf waiting for traversal and the coefficient the ray enters it at
+    struct Todo
+    {
+        uint32_t index, size;
+        double from;
+    };
+
+private:
+    std::vector<Bvh_node> nodes;
+    //leaves reference ranges of this array
+    std::vector<uint32_t> primitive_indices;
+    Box box;
+
+    uint32_t build(std::vector<Binary_node>& binary_nodes,
+                   const std::vector<Box>& bounds,
+                   const std::vector<Point>& centroids,
+                   uint32_t from, uint32_t to,
+                   size_t depth);
+    uint32_t collapse(const std::vector<Binary_node>& binary_nodes, uint32_t binary_node, size_t depth);
+
+    //traverses the subtree of start, result and limit are updated in place. Nodes and leaves
+    //are counted if counters are given
+    void traverse(const Ray& ray,
+                  const Todo& start,
+                  double& limit,
+                  Intersection& result,
+                  bool any_hit,
+                  Render_statistics* counters) const;
+
+    virtual Intersection traverse(const Ray& ray, double max_coefficient, bool any_hit) const override;
+    virtual void traverse(const Ray_packet& packet,
+                          std::array<Intersection, Ray_packet::SIZE>& result) const override;
+
+public:
+    Bvh(const std::vector<std::shared_ptr<Primitive>>& primitives);
+    //reads a hierarchy written by save
+    Bvh(const std::vector<std::shared_ptr<Primitive>>& primitives, Cache_reader& reader);
+
+    virtual void save(Cache_writer& writer) const override;
+    virtual bool refit(const std::vector<std::shared_ptr<Primitive>>& primitives) override;
+};
+
+}
+
+#endif // BVH_H
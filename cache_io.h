@@ -0,0 +1,140 @@
+#ifndef CACHE_IO_H
+#define CACHE_IO_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include "geometry.h"
+
+namespace ray_tracing
+{
+
+//appends values to a byte buffer, arrays are stored as their size followed by their raw bytes
+class Cache_writer
+{
+private:
+    std::vector<char> data;
+
+    void write_bytes(const void* bytes, size_t size)
+    {
+        data.insert(data.end(), static_cast<const char*>(bytes), static_cast<const char*>(bytes) + size);
+    }
+
+public:
+    template<typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "values are stored as raw bytes");
+        write_bytes(&value, sizeof(T));
+    }
+    template<typename T>
+    void write(const std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "values are stored as raw bytes");
+        write<uint64_t>(values.size());
+        write_bytes(values.data(), values.size() * sizeof(T));
+    }
+    void write(const std::string& value)
+    {
+        write<uint64_t>(value.size());
+        write_bytes(value.data(), value.size());
+    }
+    void write(const Point& point)
+    {
+        write(point.coordinates);
+    }
+    void write(const Box& box)
+    {
+        write(box.ld);
+        write(box.ru);
+    }
+    void append(const Cache_writer& writer)
+    {
+        write_bytes(writer.data.data(), writer.data.size());
+    }
+
+    const std::vector<char>& get_data() const
+    {
+        return data;
+    }
+
+    //writes into a temporary file renamed afterwards, so readers never see a partial cache
+    bool save(const std::string& file) const;
+};
+
+//reads values written by Cache_writer from memory, throws std::runtime_error instead of reading past the end
+class Cache_reader
+{
+private:
+    const char *it, *end;
+
+    const char* read_bytes(size_t size)
+    {
+        if(size_t(end - it) < size)
+            throw std::runtime_error("truncated cache");
+
+        const char* result = it;
+        it += size;
+
+        return result;
+    }
+
+public:
+    Cache_reader(const char* begin, const char* end)
+        : it(begin), end(end)
+    {}
+
+    template<typename T>
+    void read(T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "values are stored as raw bytes");
+        memcpy(&value, read_bytes(sizeof(T)), sizeof(T));
+    }
+    template<typename T>
+    void read(std::vector<T>& values)
+    {
+        uint64_t size;
+        read(size);
+
+        if(size > size_t(end - it) / sizeof(T))
+            throw std::runtime_error("truncated cache");
+
+        values.resize(size);
+        memcpy(values.data(), read_bytes(size * sizeof(T)), size * sizeof(T));
+    }
+    void read(std::string& value)
+    {
+        uint64_t size;
+        read(size);
+
+        const char* bytes = read_bytes(size);
+        value.assign(bytes, bytes + size);
+    }
+    void read(Point& point)
+    {
+        read(point.coordinates);
+    }
+    void read(Box& box)
+    {
+        read(box.ld);
+        read(box.ru);
+    }
+
+    //the part not read yet
+    const char* position() const
+    {
+        return it;
+    }
+    size_t remaining() const
+    {
+        return end - it;
+    }
+};
+
+}
+
+#endif // CACHE_IO_H
@@ -23,18 +23,6 @@ std::istream& ray_tracing::operator>>(std::istream& stream, ray_tracing::Point&
     return stream;
 }
 
-double ray_tracing::dot(const Point& a, const Point& b)
-{
-    return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
-}
-
-ray_tracing::Point ray_tracing::cross(const Point& a, const Point& b)
-{
-    return Point(a.y() * b.z() - a.z() * b.y(),
-                 a.z() * b.x() - a.x() * b.z(),
-                 a.x() * b.y() - a.y() * b.x());
-}
-
 double ray_tracing::determinant(const Point& a, const Point& b, const Point& c)
 {
     return a.x() * b.y() * c.z() +
@@ -60,7 +48,7 @@ int ray_tracing::signum(double x)
         return 1;
 }
 
-ray_tracing::Point ray_tracing::intersect(const Ray& ray, const Plane& plane)
+double ray_tracing::plane_coefficient(const Ray& ray, const Plane& plane)
 {
     double t;
     double det = determinant(plane.b - plane.a,
@@ -75,6 +63,16 @@ ray_tracing::Point ray_tracing::intersect(const Ray& ray, const Plane& plane)
                         ray.begin - plane.a) / det;
 
     if(t <= EPS)
+        return Ray::NOWHERE;
+    else
+        return t;
+}
+
+ray_tracing::Point ray_tracing::intersect(const Ray& ray, const Plane& plane)
+{
+    double t = plane_coefficient(ray, plane);
+
+    if(t == Ray::NOWHERE)
         return Point::NOWHERE;
     else
         return ray.begin + ray.guiding() * t;
@@ -138,6 +136,24 @@ bool ray_tracing::Box::contains(const Point& point) const
     return true;
 }
 
+void ray_tracing::Box::extend(const Point& point)
+{
+    for(int i = 0; i < Point::AXIS_SIZE; ++i)
+    {
+        ld[i] = std::min(ld[i], point[i]);
+        ru[i] = std::max(ru[i], point[i]);
+    }
+}
+
+void ray_tracing::Box::extend(const Box& box)
+{
+    for(int i = 0; i < Point::AXIS_SIZE; ++i)
+    {
+        ld[i] = std::min(ld[i], box.ld[i]);
+        ru[i] = std::max(ru[i], box.ru[i]);
+    }
+}
+
 //intersection coefficient for ray and quadrangle, perpendicular to an axis
 double intersection_coefficient(const ray_tracing::Ray& ray,
                                 ray_tracing::Point::Axis axis,
@@ -188,6 +204,39 @@ double ray_tracing::intersect(const Ray& ray, const Box& box)
     return min_coefficient;
 }
 
+std::array<double, 2> ray_tracing::clip(const Ray& ray, const Box& box)
+{
+    const std::array<double, 2> nowhere{Ray::NOWHERE, Ray::NOWHERE};
+    std::array<double, 2> result{0, std::numeric_limits<double>::max()};
+
+    Point guiding = ray.guiding();
+
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+    {
+        if(guiding[i] == 0)
+        {
+            if(ray.begin[i] < box.ld[i] || ray.begin[i] > box.ru[i])
+                return nowhere;
+
+            continue;
+        }
+
+        double  from = (box.ld[i] - ray.begin[i]) / guiding[i],
+                to = (box.ru[i] - ray.begin[i]) / guiding[i];
+
+        if(from > to)
+            std::swap(from, to);
+
+        result[0] = std::max(result[0], from);
+        result[1] = std::min(result[1], to);
+
+        if(result[0] > result[1])
+            return nowhere;
+    }
+
+    return result;
+}
+
 ray_tracing::Ray ray_tracing::reflect(const Ray& ray, const Point& intersection, const Point& normal)
 {
     Point   guiding = intersection - ray.begin,
@@ -122,8 +122,17 @@ struct Point
 
 std::istream& operator>>(std::istream& stream, Point& p);
 
-double dot(const Point& a, const Point& b);
-Point cross(const Point& a, const Point& b);
+//dot and cross are defined here, so that they are inlined into the intersection tests
+inline double dot(const Point& a, const Point& b)
+{
+    return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
+}
+inline Point cross(const Point& a, const Point& b)
+{
+    return Point(a.y() * b.z() - a.z() * b.y(),
+                 a.z() * b.x() - a.x() * b.z(),
+                 a.x() * b.y() - a.y() * b.x());
+}
 double determinant(const Point& a, const Point& b, const Point& c);
 double projection_coefficient(const Point& a, const Point& b);
 double angle(const Point& a, const Point& b, const Point& normal);
@@ -177,7 +186,137 @@ struct Plane
 };
 
 
+//coefficient of the ray and plane intersection or Ray::NOWHERE
+double plane_coefficient(const Ray& ray, const Plane& plane);
 Point intersect(const Ray& ray, const Plane& plane);
+//intersection tests are defined here, so that they are inlined into the leaf loops of the acceleration structures
+
+//ray prepared for the watertight test of Woop, Benthin and Wald: vertices are translated to its begin,
+//the axes are permuted so that z is the one along which the guiding line is the longest, x and y are
+//swapped if it goes in the negative direction to keep the winding, and the shear maps the guiding line onto z
+struct Ray_shear
+{
+    Point begin;
+    Point::Axis kx, ky, kz;
+    double sx, sy, sz;
+
+    Ray_shear()
+    {}
+    explicit Ray_shear(const Ray& ray)
+        : begin(ray.begin)
+    {
+        Point guiding = ray.guiding();
+
+        kz = Point::X;
+        if(fabs(guiding.y()) > fabs(guiding[kz]))
+            kz = Point::Y;
+        if(fabs(guiding.z()) > fabs(guiding[kz]))
+            kz = Point::Z;
+
+        kx = Point::Axis((kz + 1) % Point::AXIS_SIZE);
+        ky = Point::Axis((kx + 1) % Point::AXIS_SIZE);
+        if(guiding[kz] < 0)
+            std::swap(kx, ky);
+
+        sx = guiding[kx] / guiding[kz];
+        sy = guiding[ky] / guiding[kz];
+        sz = 1 / guiding[kz];
+    }
+
+    //the vertex in the space where the ray is the positive half of z, z is scaled so that it is the coefficient
+    Point apply(const Point& vertex) const
+    {
+        Point t = vertex - begin;
+
+        return Point(t[kx] - sx * t[kz], t[ky] - sy * t[kz], sz * t[kz]);
+    }
+};
+
+//signed doubled area of the triangle of the ray and the edge (a, b) of sheared vertices, its sign is the side
+//of the edge the ray passes. A zero may be a tiny area rounded, so it is recomputed in higher precision.
+//Triangles sharing the edge compute it of the same vertices and get opposite values, so no ray slips between them
+inline double edge_function(const Point& a, const Point& b)
+{
+    double result = b.x() * a.y() - b.y() * a.x();
+
+    if(result != 0)
+        return result;
+
+    return double((long double)b.x() * a.y() - (long double)b.y() * a.x());
+}
+
+//coefficient of the intersection with a polygon of sheared vertices, whose edge functions are of the same sign,
+//by the plane of the triangle (a, b, c) of its vertices with edge functions u = (b, c), v = (c, a), w = (a, b)
+inline double watertight_coefficient(const Point& a, const Point& b, const Point& c, double u, double v, double w)
+{
+    double det = u + v + w;
+    if(det == 0)
+        return Ray::NOWHERE;
+
+    double coefficient = (u * a.z() + v * b.z() + w * c.z()) / det;
+
+    return coefficient > EPS ? coefficient : Ray::NOWHERE;
+}
+
+//watertight intersection with the triangle (a, b, c), edges are inclusive so that no ray slips between
+//adjacent triangles sharing the vertices
+inline double triangle_coefficient(const Ray_shear& shear, const Point& a, const Point& b, const Point& c)
+{
+    Point   sa = shear.apply(a),
+            sb = shear.apply(b),
+            sc = shear.apply(c);
+
+    double  u = edge_function(sb, sc),
+            v = edge_function(sc, sa),
+            w = edge_function(sa, sb);
+
+    if((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+        return Ray::NOWHERE;
+
+    return watertight_coefficient(sa, sb, sc, u, v, w);
+}
+//same for the parallelogramm of the vertices in order, its four edges are tested at once
+inline double parallelogramm_coefficient(const Ray_shear& shear, const std::array<Point, 4>& points)
+{
+    std::array<Point, 4> sheared;
+    for(size_t i = 0; i < 4; ++i)
+        sheared[i] = shear.apply(points[i]);
+
+    std::array<double, 4> edges;
+    for(size_t i = 0; i < 4; ++i)
+        edges[i] = edge_function(sheared[i], sheared[(i + 1) % 4]);
+
+    bool    negative = edges[0] < 0 || edges[1] < 0 || edges[2] < 0 || edges[3] < 0,
+            positive = edges[0] > 0 || edges[1] > 0 || edges[2] > 0 || edges[3] > 0;
+    if(negative && positive)
+        return Ray::NOWHERE;
+
+    //the depth is found by the triangle of the first three vertices, which spans the plane
+    return watertight_coefficient(sheared[0], sheared[1], sheared[2],
+                                  edges[1], edge_function(sheared[2], sheared[0]), edges[0]);
+}
+//coefficient of the closest intersection with the sphere or Ray::NOWHERE
+inline double sphere_coefficient(const Ray& ray, const Point& center, double r)
+{
+    Point   guiding = ray.guiding(),
+            o = ray.begin - center;
+
+    double  a = dot(guiding, guiding),
+            b = dot(o, guiding),
+            c = dot(o, o) - r * r;
+
+    double discriminant = b * b - a * c;
+    if(discriminant <= 0)
+        return Ray::NOWHERE;
+
+    double root = sqrt(discriminant);
+
+    double  closer = (-b - root) / a,
+            farther = (-b + root) / a;
+    double coefficient = closer > EPS ? closer : farther;
+
+    return coefficient > EPS ? coefficient : Ray::NOWHERE;
+}
 Ray reflect(const Ray& ray, const Point& intersection, const Point& perpendicular);
 Ray reflect(const Ray& ray, const Plane& plane);
 Orientation side(const Point& point, const Plane& plane);
@@ -194,7 +333,7 @@ struct Box
         : ld(ld), ru(ru)
     {}
 
-    double surface_area()
+    double surface_area() const
     {
         return 2 * ((ru.x() - ld.x()) * (ru.y() - ld.y()) +
                     (ru.x() - ld.x()) * (ru.z() - ld.z()) +
@@ -203,9 +342,14 @@ struct Box
 
     std::array<Box, 2> split(Point::Axis axis, double splitting_plane) const;
     bool contains(const Point& point) const;
+    void extend(const Point& point);
+    void extend(const Box& box);
 };
 
 double intersect(const Ray& ray, const Box& box);
+//coefficients of the points where the ray enters and leaves the box,
+//both are Ray::NOWHERE if the ray misses it
+std::array<double, 2> clip(const Ray& ray, const Box& box);
 Ray refract(const Ray& ray, const Point& point, Point normal, double refraction);
 Point projection(const Point& a, const Point& b);
 std::array<double, 2> projections(const Point& a, const Point& b, const Point& v);
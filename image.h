@@ -0,0 +1,163 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+namespace ray_tracing
+{
+
+//allocates memory aligned to A bytes, the original pointer is kept right before the aligned block
+template<typename T, size_t A>
+struct Aligned_allocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef Aligned_allocator<U, A> other;
+    };
+
+    Aligned_allocator()
+    {}
+    template<typename U>
+    Aligned_allocator(const Aligned_allocator<U, A>&)
+    {}
+
+    T* allocate(size_t n)
+    {
+        char* raw = static_cast<char*>(::operator new(n * sizeof(T) + A));
+        void** aligned = reinterpret_cast<void**>((uintptr_t(raw) + A) & ~uintptr_t(A - 1));
+        aligned[-1] = raw;
+
+        return reinterpret_cast<T*>(aligned);
+    }
+    void deallocate(T* pointer, size_t)
+    {
+        ::operator delete(reinterpret_cast<void**>(pointer)[-1]);
+    }
+
+    template<typename U>
+    bool operator==(const Aligned_allocator<U, A>&) const
+    {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(const Aligned_allocator<U, A>&) const
+    {
+        return false;
+    }
+};
+
+template<typename T>
+class Row_view
+{
+private:
+    T* data;
+    size_t width;
+
+public:
+    Row_view(T* data, size_t width)
+        : data(data), width(width)
+    {}
+
+    T& operator[](size_t j) const
+    {
+        return data[j];
+    }
+    T* begin() const
+    {
+        return data;
+    }
+    T* end() const
+    {
+        return data + width;
+    }
+    size_t size() const
+    {
+        return width;
+    }
+};
+
+//2D array of pixels in a single allocation. Every row starts at a multiple of ALIGNMENT bytes,
+//so rows are stride() >= width() pixels apart
+template<typename T>
+class Image
+{
+public:
+    static const size_t ALIGNMENT = 64;
+
+private:
+    size_t height_, width_, stride_;
+    std::vector<T, Aligned_allocator<T, ALIGNMENT>> pixels;
+
+    static size_t aligned_stride(size_t width)
+    {
+        size_t stride = width;
+        while(stride * sizeof(T) % ALIGNMENT != 0 && stride < width + ALIGNMENT)
+            ++stride;
+
+        return stride * sizeof(T) % ALIGNMENT == 0 ? stride : width;
+    }
+    //pixels of the rows, throws std::overflow_error rather than allocating a wrapped size
+    static size_t pixels_num(size_t height, size_t stride)
+    {
+        if(stride != 0 && height > SIZE_MAX / stride)
+            throw std::overflow_error("image is too large");
+
+        return height * stride;
+    }
+
+public:
+    Image()
+        : height_(0), width_(0), stride_(0)
+    {}
+    Image(size_t height, size_t width, const T& value = T())
+        : height_(height),
+          width_(width),
+          stride_(aligned_stride(width)),
+          pixels(pixels_num(height, stride_), value)
+    {}
+
+    Row_view<T> operator[](size_t i)
+    {
+        return Row_view<T>(pixels.data() + i * stride_, width_);
+    }
+    Row_view<const T> operator[](size_t i) const
+    {
+        return Row_view<const T>(pixels.data() + i * stride_, width_);
+    }
+
+    size_t height() const
+    {
+        return height_;
+    }
+    size_t width() const
+    {
+        return width_;
+    }
+    size_t stride() const
+    {
+        return stride_;
+    }
+    bool empty() const
+    {
+        return pixels.empty();
+    }
+    T* data()
+    {
+        return pixels.data();
+    }
+    const T* data() const
+    {
+        return pixels.data();
+    }
+};
+
+}
+
+#endif // IMAGE_H
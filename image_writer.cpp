@@ -0,0 +1,193 @@
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>
+
+#include "image_writer.h"
+
+uint8_t to_byte(float x)
+{
+    return uint8_t(std::min(1.f, std::max(0.f, x)) * 255 + 0.5f);
+}
+
+//8 bit RGB rows top down. Colors are packed, so every row is converted as a plain array of floats
+std::vector<uint8_t> to_bytes(const ray_tracing::Image<ray_tracing::Color>& image)
+{
+    size_t row_size = image.width() * 3;
+    std::vector<uint8_t> result(image.height() * row_size);
+
+    for(size_t i = 0; i < image.height(); ++i)
+    {
+        const float* row = &image[image.height() - 1 - i].begin()->r;
+        uint8_t* bytes = result.data() + i * row_size;
+
+        for(size_t j = 0; j < row_size; ++j)
+            bytes[j] = to_byte(row[j]);
+    }
+
+    return result;
+}
+
+void put_big_endian(std::vector<uint8_t>& out, uint32_t x)
+{
+    for(int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(uint8_t(x >> shift));
+}
+
+uint32_t png_crc(const uint8_t* data, size_t size)
+{
+    static const std::array<uint32_t, 256> TABLE = []
+                                                   {
+                                                       std::array<uint32_t, 256> table;
+
+                                                       for(uint32_t i = 0; i < table.size(); ++i)
+                                                       {
+                                                           uint32_t c = i;
+                                                           for(size_t k = 0; k < 8; ++k)
+                                                               c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+
+                                                           table[i] = c;
+                                                       }
+
+                                                       return table;
+                                                   }();
+
+    uint32_t result = 0xffffffffu;
+
+    for(size_t i = 0; i < size; ++i)
+        result = TABLE[(result ^ data[i]) & 0xff] ^ (result >> 8);
+
+    return result ^ 0xffffffffu;
+}
+
+void put_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+    put_big_endian(out, data.size());
+
+    size_t from = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+
+    put_big_endian(out, png_crc(out.data() + from, out.size() - from));
+}
+
+//the image data is stored in uncompressed deflate blocks, so no compression library is needed
+std::vector<uint8_t> encode_png(const ray_tracing::Image<ray_tracing::Color>& image)
+{
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    static const size_t BLOCK_SIZE = 65535;
+
+    std::vector<uint8_t> bytes = to_bytes(image);
+    size_t row_size = image.width() * 3;
+
+    //every row is preceded by filter type 0
+    std::vector<uint8_t> raw;
+    raw.reserve(image.height() * (row_size + 1));
+
+    for(size_t i = 0; i < image.height(); ++i)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), bytes.begin() + i * row_size, bytes.begin() + (i + 1) * row_size);
+    }
+
+    std::vector<uint8_t> stream{0x78, 0x01};
+    uint32_t a = 1, b = 0;
+
+    size_t from = 0;
+
+    do
+    {
+        uint16_t size = std::min(BLOCK_SIZE, raw.size() - from);
+
+        stream.push_back(from + size == raw.size());
+        stream.push_back(size & 0xff);
+        stream.push_back(size >> 8);
+        stream.push_back(~size & 0xff);
+        stream.push_back(~size >> 8 & 0xff);
+        stream.insert(stream.end(), raw.begin() + from, raw.begin() + from + size);
+
+        from += size;
+    }
+    while(from < raw.size());
+
+    for(uint8_t x : raw)
+    {
+        a = (a + x) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_big_endian(stream, b << 16 | a);
+
+    std::vector<uint8_t> header;
+    put_big_endian(header, image.width());
+    put_big_endian(header, image.height());
+    //8 bit RGB, no interlacing
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+
+    std::vector<uint8_t> result(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+    put_chunk(result, "IHDR", header);
+    put_chunk(result, "IDAT", stream);
+    put_chunk(result, "IEND", {});
+
+    return result;
+}
+
+std::vector<uint8_t> encode_ppm(const ray_tracing::Image<ray_tracing::Color>& image)
+{
+    std::string header = "P6\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n255\n";
+    std::vector<uint8_t> result(header.begin(), header.end());
+    std::vector<uint8_t> bytes = to_bytes(image);
+
+    result.insert(result.end(), bytes.begin(), bytes.end());
+
+    return result;
+}
+
+//rows of PFM go bottom up, the sign of the scale tells the byte order of the floats
+std::vector<uint8_t> encode_pfm(const ray_tracing::Image<ray_tracing::Color>& image)
+{
+    uint16_t order = 1;
+    bool little = *reinterpret_cast<const uint8_t*>(&order) == 1;
+
+    std::string header = "PF\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n" +
+                         (little ? "-1.0" : "1.0") + "\n";
+    std::vector<uint8_t> result(header.begin(), header.end());
+
+    for(size_t i = 0; i < image.height(); ++i)
+        for(size_t j = 0; j < image.width(); ++j)
+        {
+            const ray_tracing::Color& color = image[i][j];
+            float channels[3] = {color.r, color.g, color.b};
+
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(channels);
+            result.insert(result.end(), bytes, bytes + sizeof(channels));
+        }
+
+    return result;
+}
+
+void ray_tracing::save_image(const Image<Color>& image, const std::string& file)
+{
+    std::string extension = file.substr(std::min(file.size(), file.rfind('.') + 1));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    std::vector<uint8_t> data;
+
+    if(extension == "png")
+        data = encode_png(image);
+    else if(extension == "ppm")
+        data = encode_ppm(image);
+    else if(extension == "pfm")
+        data = encode_pfm(image);
+    else
+        throw std::runtime_error("unknown image format of " + file);
+
+    std::ofstream out(file, std::ios_base::out | std::ios_base::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    if(!out)
+        throw std::runtime_error("can't write " + file);
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <string>
+
+#include "picture.h"
+#include "image.h"
+
+namespace ray_tracing
+{
+
+//encodes the picture by the extension of the file: PNG and binary PPM are 8 bit with the colors
+//clamped to [0, 1], PFM keeps them as they are. Rows of the picture go bottom up.
+//Throws std::runtime_error if the format is unknown or the file can't be written
+void save_image(const Image<Color>& image, const std::string& file);
+
+}
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <limits>
+
+#include "instance.h"
+
+ray_tracing::Transform ray_tracing::Transform::translate(const Point& shift)
+{
+    return Transform({Point(1, 0, 0), Point(0, 1, 0), Point(0, 0, 1)}, shift);
+}
+
+ray_tracing::Transform ray_tracing::Transform::scale(const Point& factors)
+{
+    return Transform({Point(factors.x(), 0, 0), Point(0, factors.y(), 0), Point(0, 0, factors.z())}, Point(0, 0, 0));
+}
+
+//Rodrigues' rotation formula
+ray_tracing::Transform ray_tracing::Transform::rotate(const Point& axis, double angle)
+{
+    Point k = axis.normalized();
+    double  c = cos(angle * M_PI / 180),
+            s = sin(angle * M_PI / 180);
+
+    return Transform({Point(c + (1 - c) * k.x() * k.x(),
+                            (1 - c) * k.x() * k.y() - s * k.z(),
+                            (1 - c) * k.x() * k.z() + s * k.y()),
+                      Point((1 - c) * k.y() * k.x() + s * k.z(),
+                            c + (1 - c) * k.y() * k.y(),
+                            (1 - c) * k.y() * k.z() - s * k.x()),
+                      Point((1 - c) * k.z() * k.x() - s * k.y(),
+                            (1 - c) * k.z() * k.y() + s * k.x(),
+                            c + (1 - c) * k.z() * k.z())},
+                     Point(0, 0, 0));
+}
+
+ray_tracing::Transform ray_tracing::Transform::operator*(const Transform& transform) const
+{
+    std::array<Point, Point::AXIS_SIZE> result;
+
+    //rows of the product are rows of this one applied to the transposed other one
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+        result[i] = transform.apply_transposed(rows[i]);
+
+    return Transform(result, apply(transform.translation));
+}
+
+//the inverse of the linear part is its adjugate divided by the determinant
+ray_tracing::Transform ray_tracing::Transform::inverse() const
+{
+    std::array<Point, Point::AXIS_SIZE> columns{cross(rows[1], rows[2]),
+                                                cross(rows[2], rows[0]),
+                                                cross(rows[0], rows[1])};
+    double det = determinant();
+    std::array<Point, Point::AXIS_SIZE> result;
+
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+        result[i] = Point(columns[0][i], columns[1][i], columns[2][i]) / det;
+
+    Transform linear(result, Point(0, 0, 0));
+
+    return Transform(result, -linear.apply_vector(translation));
+}
+
+ray_tracing::Geometry_group::Geometry_group(std::vector<std::shared_ptr<Primitive>>&& primitives_)
+    : primitives(std::move(primitives_)),
+      changed(false)
+{
+    bound();
+}
+
+void ray_tracing::Geometry_group::bound()
+{
+    box = Box(Point::MAX, -Point::MAX);
+
+    for(const std::shared_ptr<Primitive>& primitive : primitives)
+        box.extend(primitive->bounds());
+}
+
+bool ray_tracing::Geometry_group::build(Acceleration acceleration, Thread_pool& pool)
+{
+    if(tree && !changed)
+        return false;
+
+    if(changed)
+        bound();
+
+    if(!tree || !tree->refit(primitives))
+        tree = build_acceleration_structure(acceleration, primitives, pool);
+
+    changed = false;
+
+    return true;
+}
+
+ray_tracing::Hit ray_tracing::Instance::to_local(const Hit& hit) const
+{
+    Hit result = hit;
+
+    result.point = inverse.apply(hit.point);
+    result.normal = transform.apply_transposed(hit.normal);
+    //the footprint is scaled by the average scale of the inverse transform
+    result.footprint = hit.footprint * cbrt(fabs(inverse.determinant()));
+
+    return result;
+}
+
+double ray_tracing::Instance::intersect(const Ray& ray) const
+{
+    return group->get_tree().intersect(inverse.apply(ray));
+}
+
+//the element hit isn't known here, so the group is traced again
+ray_tracing::Hit ray_tracing::Instance::hit(const Ray& ray, double coefficient) const
+{
+    uint32_t part;
+    intersect(ray, std::numeric_limits<double>::max(), false, part);
+
+    return hit(ray, coefficient, part);
+}
+
+//coefficients are kept by the transform, so the limit applies to the group as it is
+double ray_tracing::Instance::intersect(const Ray& ray, double max_coefficient, bool any_hit, uint32_t& part) const
+{
+    Intersection local = group->get_tree().find(inverse.apply(ray), max_coefficient, any_hit);
+    part = local.element;
+
+    return local.coefficient;
+}
+
+//groups hold no instances, so the element alone tells the hit of the group
+ray_tracing::Hit ray_tracing::Instance::hit(const Ray& ray, double coefficient, uint32_t part) const
+{
+    Hit local = group->get_tree().hit(Intersection{coefficient, part, 0}, inverse.apply(ray));
+
+    Hit result = local;
+
+    result.coefficient = coefficient;
+    result.point = ray.begin + ray.guiding() * coefficient;
+    result.normal = inverse.apply_transposed(local.normal);
+    result.instanced = local.primitive;
+
+    return result;
+}
+
+double ray_tracing::Instance::point(Point::Axis axis, Either either) const
+{
+    //an empty group is bounded by its origin
+    Box box = group->get_box().ld.x() <= group->get_box().ru.x() ? group->get_box() :
+                                                                   Box(Point(0, 0, 0), Point(0, 0, 0));
+    double result = either == Either::LEFTEST ? Point::MAX[axis] : -Point::MAX[axis];
+
+    for(size_t i = 0; i < 8; ++i)
+    {
+        Point corner = transform.apply(Point(i & 1 ? box.ru.x() : box.ld.x(),
+                                             i & 2 ? box.ru.y() : box.ld.y(),
+                                             i & 4 ? box.ru.z() : box.ld.z()));
+
+        result = either == Either::LEFTEST ? std::min(result, corner[axis]) : std::max(result, corner[axis]);
+    }
+
+    return result;
+}
+
+ray_tracing::Orientation ray_tracing::Instance::side(const Ray& ray, const Hit& hit) const
+{
+    return hit.instanced->side(inverse.apply(ray), to_local(hit));
+}
+
+//a replaced surface refracts as the boundary of a solid, like a sphere does
+ray_tracing::Ray ray_tracing::Instance::refract(const Ray& ray, const Hit& hit) const
+{
+    if(overridden)
+        return ray_tracing::refract(ray,
+                                    hit.point,
+                                    hit.normal,
+                                    hit.side == Orientation::UP ? surface.refraction : 1. / surface.refraction);
+
+    return transform.apply(hit.instanced->refract(inverse.apply(ray), to_local(hit)));
+}
+
+ray_tracing::Color ray_tracing::Instance::get_color(const Hit& hit) const
+{
+    return overridden ? surface.color : hit.instanced->get_color(to_local(hit));
+}
+
+double ray_tracing::Instance::get_transparency(const Hit& hit) const
+{
+    return overridden ? surface.transparency : hit.instanced->get_transparency(hit);
+}
+
+double ray_tracing::Instance::get_alpha(const Hit& hit) const
+{
+    return overridden ? surface.alpha : hit.instanced->get_alpha(hit);
+}
+
+double ray_tracing::Instance::get_refraction(const Hit& hit) const
+{
+    return overridden ? surface.refraction : hit.instanced->get_refraction(hit);
+}
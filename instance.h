@@ -0,0 +1,172 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <vector>
+#include <array>
+#include <memory>
+
+#include "primitive.h"
+#include "geometry.h"
+#include "acceleration_structure.h"
+#include "thread_pool.h"
+
+namespace ray_tracing
+{
+
+//affine map x -> rows * x + translation
+class Transform
+{
+private:
+    std::array<Point, Point::AXIS_SIZE> rows;
+    Point translation;
+
+public:
+    Transform()
+        : rows{Point(1, 0, 0), Point(0, 1, 0), Point(0, 0, 1)}, translation(0, 0, 0)
+    {}
+    Transform(const std::array<Point, Point::AXIS_SIZE>& rows, const Point& translation)
+        : rows(rows), translation(translation)
+    {}
+
+    static Transform translate(const Point& shift);
+    static Transform scale(const Point& factors);
+    //counterclockwise looking against the axis, the angle is in degrees
+    static Transform rotate(const Point& axis, double angle);
+
+    //transform applied first, then this one
+    Transform operator*(const Transform& transform) const;
+    //the transform is to be invertible
+    Transform inverse() const;
+    double determinant() const
+    {
+        return ray_tracing::determinant(rows[0], rows[1], rows[2]);
+    }
+
+    Point apply(const Point& point) const
+    {
+        return apply_vector(point) + translation;
+    }
+    //directions aren't translated
+    Point apply_vector(const Point& vector) const
+    {
+        return Point(dot(rows[0], vector), dot(rows[1], vector), dot(rows[2], vector));
+    }
+    //normals are mapped by the transposed inverse transform
+    Point apply_transposed(const Point& vector) const
+    {
+        return rows[0] * vector.x() + rows[1] * vector.y() + rows[2] * vector.z();
+    }
+    //coefficients along the ray are kept, as the map is affine
+    Ray apply(const Ray& ray) const
+    {
+        return Ray(apply(ray.begin), apply(ray.second));
+    }
+};
+
+//primitives placed into the scene by instances. The group is built into an acceleration
+//structure once, however many instances of it there are. The primitives may be changed
+//between pictures, the structure is refit or built again by the next build then
+class Geometry_group
+{
+private:
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    Box box;
+    std::unique_ptr<Acceleration_structure> tree;
+    bool changed;
+
+    void bound();
+
+public:
+    Geometry_group(std::vector<std::shared_ptr<Primitive>>&& primitives);
+
+    //returns whether the group has been built or refit, does nothing if it hasn't changed since
+    bool build(Acceleration acceleration, Thread_pool& pool);
+
+    //a primitive of the same type keeps the structure, which is refit then
+    void set_primitive(size_t index, const std::shared_ptr<Primitive>& primitive)
+    {
+        primitives[index] = primitive;
+        changed = true;
+    }
+    void add_primitive(const std::shared_ptr<Primitive>& primitive)
+    {
+        primitives.push_back(primitive);
+        changed = true;
+    }
+    void remove_primitive(size_t index)
+    {
+        primitives.erase(primitives.begin() + index);
+        changed = true;
+    }
+
+    const std::vector<std::shared_ptr<Primitive>>& get_primitives() const
+    {
+        return primitives;
+    }
+    const Box& get_box() const
+    {
+        return box;
+    }
+    //the group is to be built
+    const Acceleration_structure& get_tree() const
+    {
+        return *tree;
+    }
+};
+
+//a group placed into the scene by a transform from its own coordinates. Rays are traced in
+//the coordinates of the group, and hits are reported as the instance with the primitive of the
+//group in hit.instanced. The surface, if given, replaces the surfaces of the group's primitives
+class Instance : public virtual Primitive
+{
+private:
+    std::shared_ptr<Geometry_group> group;
+    Transform transform, inverse;
+    bool overridden;
+    Surface<Color> surface;
+
+    //the hit in the coordinates of the group
+    Hit to_local(const Hit& hit) const;
+
+public:
+    Instance(const std::shared_ptr<Geometry_group>& group, const Transform& transform)
+        : group(group), transform(transform), inverse(transform.inverse()), overridden(false)
+    {}
+    Instance(const std::shared_ptr<Geometry_group>& group,
+             const Transform& transform,
+             const Surface<Color>& surface)
+        : group(group), transform(transform), inverse(transform.inverse()), overridden(true), surface(surface)
+    {}
+
+    virtual double intersect(const Ray& ray) const override;
+    virtual Hit hit(const Ray& ray, double coefficient) const override;
+    //the group is traversed within the limit, the part is the element of its tree hit
+    virtual double intersect(const Ray& ray, double max_coefficient, bool any_hit, uint32_t& part) const override;
+    virtual Hit hit(const Ray& ray, double coefficient, uint32_t part) const override;
+    virtual double point(Point::Axis axis, Either either) const override;
+    virtual Orientation side(const Ray& ray, const Hit& hit) const override;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const override;
+    virtual Color get_color(const Hit& hit) const override;
+    virtual double get_transparency(const Hit& hit) const override;
+    virtual double get_alpha(const Hit& hit) const override;
+    virtual double get_refraction(const Hit& hit) const override;
+
+    Geometry_group& get_group() const
+    {
+        return *group;
+    }
+    const Transform& get_transform() const
+    {
+        return transform;
+    }
+    //instances of a scene being rendered are moved through Tracer::set_transform
+    void set_transform(const Transform& transform_)
+    {
+        transform = transform_;
+        inverse = transform.inverse();
+    }
+};
+
+}
+
+#endif // INSTANCE_H
@@ -1,156 +1,541 @@
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 
 #include "kd_tree.h"
 #include "geometry.h"
 #include "primitive.h"
 
-ray_tracing::Kd_tree::Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives)
-    : root(std::make_shared<Node>())
+//calls function(chunk, from, to) for chunks_num consecutive chunks of [0, size) on the pool
+template<typename F>
+void parallel_chunks(ray_tracing::Thread_pool& pool, size_t size, size_t chunks_num, F function)
 {
-    root->box = Box(Point::MAX, Point::MIN);
+    pool.parallel_for(chunks_num,
+                      [size, chunks_num, &function](size_t i)
+                      {
+                          function(i, size * i / chunks_num, size * (i + 1) / chunks_num);
+                      });
+}
 
-    for(const std::shared_ptr<Primitive>& primitive : primitives)
-    {
+ray_tracing::Kd_tree::Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives, Thread_pool& pool)
+    : Acceleration_structure("kd tree", primitives),
+      pool(&pool),
+      box(Point::MAX, Point::MIN),
+      max_depth(std::min<size_t>(MAX_DEPTH, 8 + 1.3 * log2(elements.size() + 1))),
+      threads_num(pool.size()),
+      fork_depth(threads_num == 1 ? 0 : ceil(log2(threads_num)) + 2)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<Box> bounds(elements.size());
+    std::vector<uint32_t> indices(elements.size());
+
+    parallel_chunks(pool,
+                    elements.size(),
+                    elements.size() < PARALLEL_SPLIT_SIZE ? 1 : threads_num,
+                    [this, &bounds, &indices](size_t, size_t from, size_t to)
+                    {
+                        for(size_t i = from; i < to; ++i)
+                        {
+                            indices[i] = i;
+                            bounds[i] = elements.bounds(i);
+                        }
+                    });
+
+    for(const Box& primitive_box : bounds)
         for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
         {
-            root->box.ld[i] = std::min(root->box.ld[i], primitive->point(Point::Axis(i), Either::LEFTEST));
-            root->box.ru[i] = std::max(root->box.ru[i], primitive->point(Point::Axis(i), Either::RIGHTEST));
+            box.ld[i] = std::min(box.ld[i], primitive_box.ld[i]);
+            box.ru[i] = std::max(box.ru[i], primitive_box.ru[i]);
         }
+
+    Subtree tree{};
+    build(tree, box, std::move(indices), bounds, 0);
+
+    nodes = std::move(tree.nodes);
+    primitive_indices = std::move(tree.primitive_indices);
+
+    //leaves sorted by element indices are tested by runs of a single type
+    for(const Node& node : nodes)
+        if(node.is_leaf())
+            std::sort(primitive_indices.begin() + node.offset(),
+                      primitive_indices.begin() + node.offset() + node.size());
+
+    statistics.build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    statistics.primitives_num = elements.size();
+    statistics.nodes_num = nodes.size();
+    statistics.leaves_num = tree.leaves_num;
+    statistics.references_num = primitive_indices.size();
+    statistics.depth = tree.depth;
+}
+
+ray_tracing::Kd_tree::Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives, Cache_reader& reader)
+    : Acceleration_structure("kd tree", primitives),
+      pool(nullptr),
+      max_depth(0),
+      threads_num(0),
+      fork_depth(0)
+{
+    reader.read(box);
+    reader.read(nodes);
+    reader.read(primitive_indices);
+    load_statistics(reader);
+
+    for(size_t i = 0; i < nodes.size(); ++i)
+        if(nodes[i].is_leaf() ? size_t(nodes[i].offset()) + nodes[i].size() > primitive_indices.size() :
+                                nodes[i].right() <= i + 1 || nodes[i].right() >= nodes.size())
+            throw std::runtime_error("corrupted kd tree");
+
+    for(uint32_t index : primitive_indices)
+        if(index >= elements.size())
+            throw std::runtime_error("corrupted kd tree");
+
+    if(nodes.empty())
+        throw std::runtime_error("corrupted kd tree");
+}
+
+void ray_tracing::Kd_tree::save(Cache_writer& writer) const
+{
+    writer.write(box);
+    writer.write(nodes);
+    writer.write(primitive_indices);
+    save_statistics(writer);
+}
+
+void ray_tracing::Kd_tree::Subtree::append(const Subtree& subtree)
+{
+    uint32_t    nodes_shift = nodes.size(),
+                primitives_shift = primitive_indices.size();
+
+    for(Node node : subtree.nodes)
+    {
+        node.shift(nodes_shift, primitives_shift);
+        nodes.push_back(node);
     }
 
-    build(root, primitives);
+    primitive_indices.insert(primitive_indices.end(),
+                             subtree.primitive_indices.begin(),
+                             subtree.primitive_indices.end());
+
+    leaves_num += subtree.leaves_num;
+    depth = std::max(depth, subtree.depth);
 }
 
-std::array<std::vector<std::shared_ptr<ray_tracing::Primitive>>, 2>
-    ray_tracing::Kd_tree::split(const std::vector<std::shared_ptr<Primitive>>& primitives,
+std::array<std::vector<uint32_t>, 2>
+    ray_tracing::Kd_tree::split(const std::vector<uint32_t>& indices,
+                                const std::vector<Box>& bounds,
                                 Point::Axis axis,
                                 double splitting_plane) const
 {
-    std::array<std::vector<std::shared_ptr<ray_tracing::Primitive>>, 2> result;
+    size_t chunks_num = indices.size() < PARALLEL_SPLIT_SIZE ? 1 : threads_num;
+    std::vector<std::array<std::vector<uint32_t>, 2>> chunks(chunks_num);
 
-    for(const std::shared_ptr<Primitive>& primitive : primitives)
-    {
-        if(primitive->point(axis, Either::LEFTEST) <= splitting_plane)
-            result[0].push_back(primitive);
-        if(primitive->point(axis, Either::RIGHTEST) >= splitting_plane)
-            result[1].push_back(primitive);
-    }
+    parallel_chunks(*pool,
+                    indices.size(),
+                    chunks_num,
+                    [&](size_t chunk, size_t from, size_t to)
+                    {
+                        for(size_t i = from; i < to; ++i)
+                        {
+                            if(bounds[indices[i]].ld[axis] <= splitting_plane)
+                                chunks[chunk][0].push_back(indices[i]);
+                            if(bounds[indices[i]].ru[axis] >= splitting_plane)
+                                chunks[chunk][1].push_back(indices[i]);
+                        }
+                    });
+
+    if(chunks_num == 1)
+        return std::move(chunks[0]);
+
+    //chunks are concatenated in order, so the result doesn't depend on the number of threads
+    std::array<std::vector<uint32_t>, 2> result;
+
+    for(size_t k = 0; k < 2; ++k)
+        for(const std::array<std::vector<uint32_t>, 2>& chunk : chunks)
+            result[k].insert(result[k].end(), chunk[k].begin(), chunk[k].end());
 
     return result;
 }
 
-void ray_tracing::Kd_tree::build(const std::shared_ptr<Node>& node,
-                                 const std::vector<std::shared_ptr<Primitive>>& primitives)
+ray_tracing::Kd_tree::Split ray_tracing::Kd_tree::find_split(const Box& node_box,
+                                                             const std::vector<uint32_t>& indices,
+                                                             const std::vector<Box>& bounds) const
 {
-    Point::Axis best_splitting_axis;
-    double best_splitting_plane;
-    double  current_cost = primitives.size() * node->box.surface_area(),
-            best_cost = current_cost;
+    Split best{Point::X, 0, std::numeric_limits<double>::max()};
+    double surface_area = node_box.surface_area();
+
+    if(surface_area <= 0)
+        return best;
+
+    //number of primitives starting and ending in each bin
+    typedef std::array<std::array<size_t, BINS_NUM>, Point::AXIS_SIZE> Bins;
+
+    size_t chunks_num = indices.size() < PARALLEL_SPLIT_SIZE ? 1 : threads_num;
+    std::vector<std::array<Bins, 2>> chunks(chunks_num, std::array<Bins, 2>{});
+
+    parallel_chunks(*pool,
+                    indices.size(),
+                    chunks_num,
+                    [&](size_t chunk, size_t from, size_t to)
+                    {
+                        for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+                        {
+                            double width = node_box.ru[i] - node_box.ld[i];
+
+                            if(width <= 0)
+                                continue;
+
+                            auto bin = [&node_box, width, i](double x)
+                                       {
+                                           return std::min(BINS_NUM - 1,
+                                                           size_t(std::max(0.0,
+                                                                           (x - node_box.ld[i]) / width * BINS_NUM)));
+                                       };
+
+                            for(size_t j = from; j < to; ++j)
+                            {
+                                ++chunks[chunk][0][i][bin(bounds[indices[j]].ld[i])];
+                                ++chunks[chunk][1][i][bin(bounds[indices[j]].ru[i])];
+                            }
+                        }
+                    });
+
+    Bins& starts = chunks[0][0];
+    Bins& ends = chunks[0][1];
+
+    for(size_t chunk = 1; chunk < chunks_num; ++chunk)
+        for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+            for(size_t j = 0; j < BINS_NUM; ++j)
+            {
+                starts[i][j] += chunks[chunk][0][i][j];
+                ends[i][j] += chunks[chunk][1][i][j];
+            }
 
     for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
     {
-        for(size_t j = 1; j < SPLITTING_PLANES_NUM; ++j)
-        {
-            double splitting_plane = node->box.ld[i] +
-                                    (node->box.ru[i] - node->box.ld[i]) * j / SPLITTING_PLANES_NUM;
+        double  from = node_box.ld[i],
+                width = node_box.ru[i] - from;
+
+        if(width <= 0)
+            continue;
 
-            std::array<std::vector<std::shared_ptr<ray_tracing::Primitive>>, 2> primitives_pair =
-                    split(primitives, Point::Axis(i), splitting_plane);
+        size_t  left_num = 0,
+                right_num = indices.size();
 
-            if(primitives_pair[0].empty() || primitives_pair[1].empty())
+        for(size_t j = 1; j < BINS_NUM; ++j)
+        {
+            left_num += starts[i][j - 1];
+            right_num -= ends[i][j - 1];
+
+            float plane = from + width * j / BINS_NUM;
+            if(plane <= from || plane >= node_box.ru[i])
                 continue;
 
-            std::array<Box, 2> box_pair = node->box.split(Point::Axis(i), splitting_plane);
+            std::array<Box, 2> box_pair = node_box.split(Point::Axis(i), plane);
 
-            double cost = 0;
-            for(size_t k = 0; k < 2; ++k)
-                cost += primitives_pair[k].size() * box_pair[k].surface_area();
+            double cost = TRAVERSAL_COST +
+                          INTERSECTION_COST * (left_num == 0 || right_num == 0 ? 1 - EMPTY_BONUS : 1) *
+                          (left_num * box_pair[0].surface_area() + right_num * box_pair[1].surface_area()) /
+                          surface_area;
 
-            if(cost < best_cost)
-            {
-                best_cost = cost;
-                best_splitting_axis = Point::Axis(i);
-                best_splitting_plane = splitting_plane;
-            }
+            if(cost < best.cost)
+                best = Split{Point::Axis(i), plane, cost};
         }
     }
 
-    if(best_cost == current_cost)
+    return best;
+}
+
+void ray_tracing::Kd_tree::build(Subtree& subtree,
+                                 const Box& node_box,
+                                 std::vector<uint32_t>&& indices,
+                                 const std::vector<Box>& bounds,
+                                 size_t depth) const
+{
+    subtree.depth = std::max(subtree.depth, depth);
+
+    Split best{Point::X, 0, std::numeric_limits<double>::max()};
+    if(depth < max_depth && indices.size() > LEAF_SIZE)
+        best = find_split(node_box, indices, bounds);
+
+    if(best.cost >= INTERSECTION_COST * indices.size())
     {
-        node->contents = primitives;
+        ++subtree.leaves_num;
+        subtree.nodes.push_back(Node::leaf(subtree.primitive_indices.size(), indices.size()));
+        subtree.primitive_indices.insert(subtree.primitive_indices.end(), indices.begin(), indices.end());
         return;
     }
 
-    std::array<std::vector<std::shared_ptr<ray_tracing::Primitive>>, 2> primitives_pair =
-            split(primitives, best_splitting_axis, best_splitting_plane);
+    std::array<std::vector<uint32_t>, 2> indices_pair = split(indices, bounds, best.axis, best.plane);
+    std::array<Box, 2> box_pair = node_box.split(best.axis, best.plane);
 
-    node->left = std::make_shared<Node>();
-    node->right = std::make_shared<Node>();
+    indices.clear();
+    indices.shrink_to_fit();
 
-    std::array<Box, 2> box_pair = node->box.split(best_splitting_axis, best_splitting_plane);
-    node->left->box = box_pair[0];
-    node->right->box = box_pair[1];
+    size_t node = subtree.nodes.size();
+    subtree.nodes.push_back(Node::interior(best.axis, best.plane));
 
-    build(node->left, primitives_pair[0]);
-    build(node->right, primitives_pair[1]);
-}
+    if(depth < fork_depth && indices_pair[1].size() >= PARALLEL_BUILD_SIZE)
+    {
+        Subtree right{};
+        pool->parallel_for(2,
+                           [this, &subtree, &right, &box_pair, &indices_pair, &bounds, depth](size_t i)
+                           {
+                               build(i == 0 ? subtree : right, box_pair[i], std::move(indices_pair[i]),
+                                     bounds, depth + 1);
+                           });
 
-std::shared_ptr<ray_tracing::Primitive> ray_tracing::Kd_tree::trace(const Ray& ray) const
-{
-    return trace(root, ray);
+        subtree.nodes[node].set_right(subtree.nodes.size());
+        subtree.append(right);
+    }
+    else
+    {
+        build(subtree, box_pair[0], std::move(indices_pair[0]), bounds, depth + 1);
+        subtree.nodes[node].set_right(subtree.nodes.size());
+        build(subtree, box_pair[1], std::move(indices_pair[1]), bounds, depth + 1);
+    }
 }
 
-std::shared_ptr<ray_tracing::Primitive>
-    ray_tracing::Kd_tree::trace(const std::shared_ptr<Node>& node, const Ray& ray) const
+void ray_tracing::Kd_tree::traverse(const Ray& ray,
+                                   const Todo& start,
+                                   double& limit,
+                                   Intersection& result,
+                                   bool any_hit,
+                                   Render_statistics* counters) const
 {
-    if(!node->contents.empty())
+    std::array<Todo, MAX_DEPTH + 1> todo;
+    size_t todo_size = 0;
+
+    Point guiding = ray.guiding();
+    size_t nodes_visited = 0;
+
+    uint32_t current = start.node;
+    double from = start.from, to = start.to;
+
+    while(true)
     {
-        double coefficient = Ray::NOWHERE;
-        std::shared_ptr<Primitive> result_primitive;
+        //everything left is farther than the closest intersection found
+        if(limit < from)
+            break;
 
-        for(const std::shared_ptr<Primitive>& primitive : node->contents)
+        const Node& node = nodes[current];
+
+        if(!node.is_leaf())
         {
-            Point intersection = primitive->intersect(ray);
+            ++nodes_visited;
 
-            if(!node->box.contains(intersection))
-                continue;
+            Point::Axis axis = node.axis();
+            double plane = node.plane();
+
+            bool left_first =   ray.begin[axis] < plane ||
+                                (ray.begin[axis] == plane && guiding[axis] <= 0);
+            uint32_t    first = left_first ? current + 1 : node.right(),
+                        second = left_first ? node.right() : current + 1;
+
+            double plane_coefficient = eq_zero(guiding[axis]) ? Ray::NOWHERE :
+                                                                (plane - ray.begin[axis]) / guiding[axis];
 
-            double current_coefficient = ray.coefficient(intersection);
-            if(current_coefficient != Ray::NOWHERE &&
-               (coefficient == Ray::NOWHERE
-                || coefficient > current_coefficient))
+            if(plane_coefficient > to || plane_coefficient <= 0)
+                current = first;
+            else if(plane_coefficient < from)
+                current = second;
+            else
             {
-                coefficient = current_coefficient;
-                result_primitive = primitive;
+                todo[todo_size++] = Todo{second, plane_coefficient, to};
+                current = first;
+                to = plane_coefficient;
             }
+
+            continue;
         }
 
-        if(coefficient != Ray::NOWHERE)
-            return result_primitive;
-        else
-            return nullptr;
+        if(counters)
+            counters->count_leaf(elements,
+                                 primitive_indices.data() + node.offset(),
+                                 primitive_indices.data() + node.offset() + node.size());
+
+        elements.intersect(ray,
+                           primitive_indices.data() + node.offset(),
+                           primitive_indices.data() + node.offset() + node.size(),
+                           any_hit,
+                           limit,
+                           result);
+
+        if(todo_size == 0 || (any_hit && result.coefficient != Ray::NOWHERE))
+            break;
+
+        --todo_size;
+        current = todo[todo_size].node;
+        from = todo[todo_size].from;
+        to = todo[todo_size].to;
     }
 
-    std::pair<double, std::shared_ptr<Node>> left(intersect(ray, node->left->box), node->left),
-                                             right(intersect(ray, node->right->box), node->right);
+    if(counters)
+        counters->nodes_visited += nodes_visited;
+}
+
+ray_tracing::Intersection ray_tracing::Kd_tree::traverse(const Ray& ray,
+                                                         double max_coefficient,
+                                                         bool any_hit) const
+{
+    //loaded once, so that traversals not counted only pay for a few predictable branches
+    Render_statistics* counters = thread_statistics;
+    if(counters)
+        ++counters->traversals;
 
-    if(left > right)
-        std::swap(left, right);
+    Intersection result{Ray::NOWHERE, 0, 0};
 
-    if(left.first == Ray::NOWHERE)
+    std::array<double, 2> range = clip(ray, box);
+    if(range[0] == Ray::NOWHERE || range[0] > max_coefficient)
+        return result;
+
+    //intersections farther than limit are of no interest
+    double limit = max_coefficient;
+
+    traverse(ray, Todo{0, range[0], std::min(range[1], max_coefficient)}, limit, result, any_hit, counters);
+
+    return result;
+}
+
+void ray_tracing::Kd_tree::traverse(const Ray_packet& packet,
+                                    std::array<Intersection, Ray_packet::SIZE>& result) const
+{
+    Render_statistics* counters = thread_statistics;
+    if(counters)
+        counters->traversals += packet.size;
+
+    result.fill(Intersection{Ray::NOWHERE, 0, 0});
+
+    //lanes out of use and rays missing the tree don't enter the root
+    Ray_packet::Lanes limit;
+    Packet_todo current;
+    size_t active = 0;
+
+    current.node = 0;
+    for(size_t j = 0; j < Ray_packet::SIZE; ++j)
     {
-        if(right.first == Ray::NOWHERE)
-            return nullptr;
-        else
-            return trace(right.second, ray);
+        std::array<double, 2> range = j < packet.size ? clip(packet.rays[j], box) :
+                                                        std::array<double, 2>{Ray::NOWHERE, Ray::NOWHERE};
+        bool inside = range[0] != Ray::NOWHERE;
+
+        limit[j] = std::numeric_limits<double>::max();
+        current.from[j] = inside ? range[0] : std::numeric_limits<double>::max();
+        current.to[j] = inside ? range[1] : -1;
+        active += inside;
     }
-    else
+
+    if(active == 0)
+        return;
+
+    std::array<Packet_todo, MAX_DEPTH + 1> todo;
+    size_t todo_size = 0;
+    size_t nodes_visited = 0;
+
+    while(true)
     {
-        std::shared_ptr<Primitive> left_intersection = trace(left.second, ray);
-        if(left_intersection)
-            return left_intersection;
-        else
-            return trace(right.second, ray);
+        //rays which have found an intersection nearer than the node are done with it, as single rays are
+        std::array<bool, Ray_packet::SIZE> entering;
+        size_t entering_num = 0;
+
+        for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+        {
+            entering[j] = current.from[j] <= current.to[j] && current.from[j] <= limit[j];
+            entering_num += entering[j];
+        }
+
+        const Node& node = nodes[current.node];
+
+        if(entering_num != 0 && node.is_leaf())
+        {
+            if(counters)
+                counters->count_leaf(elements,
+                                     primitive_indices.data() + node.offset(),
+                                     primitive_indices.data() + node.offset() + node.size(),
+                                     entering_num);
+
+            //the other rays don't look for intersections here, so that every ray finds the one it does alone
+            Ray_packet::Lanes leaf_limit;
+            for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                leaf_limit[j] = entering[j] ? limit[j] : -1;
+
+            elements.intersect(packet,
+                               primitive_indices.data() + node.offset(),
+                               primitive_indices.data() + node.offset() + node.size(),
+                               leaf_limit,
+                               result);
+
+            for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                if(entering[j])
+                    limit[j] = leaf_limit[j];
+        }
+        else if(entering_num != 0)
+        {
+            Point::Axis axis = node.axis();
+            double plane = node.plane();
+            const double    *begin = packet.begin[axis].data(),
+                            *guiding = packet.guiding[axis].data();
+
+            size_t left_first_num = 0;
+            for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                left_first_num += entering[j] && (begin[j] < plane || (begin[j] == plane && guiding[j] <= 0));
+
+            //the packet diverges here, so the rays entering the node go on their own
+            if((left_first_num != 0 && left_first_num != entering_num) || entering_num * DIVERGENCE_RATIO < active)
+            {
+                for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                    if(entering[j])
+                        traverse(packet.rays[j],
+                                 Todo{current.node, current.from[j], current.to[j]},
+                                 limit[j], result[j],
+                                 false,
+                                 counters);
+            }
+            else
+            {
+                ++nodes_visited;
+
+                bool left_first = left_first_num != 0;
+                Packet_todo first{left_first ? current.node + 1 : node.right(), current.from, current.to},
+                            second{left_first ? node.right() : current.node + 1, current.from, current.to};
+
+                //the parts of the rays on both sides of the plane, the same as for single rays
+                for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+                {
+                    double plane_coefficient = eq_zero(guiding[j]) ? Ray::NOWHERE : (plane - begin[j]) / guiding[j];
+
+                    if(plane_coefficient > current.to[j] || plane_coefficient <= 0)
+                    {
+                        second.from[j] = std::numeric_limits<double>::max();
+                        second.to[j] = -1;
+                    }
+                    else if(plane_coefficient < current.from[j])
+                    {
+                        first.from[j] = std::numeric_limits<double>::max();
+                        first.to[j] = -1;
+                    }
+                    else
+                    {
+                        first.to[j] = plane_coefficient;
+                        second.from[j] = plane_coefficient;
+                    }
+                }
+
+                todo[todo_size++] = second;
+                current = first;
+
+                continue;
+            }
+        }
+
+        if(todo_size == 0)
+            break;
+
+        current = todo[--todo_size];
     }
+
+    if(counters)
+        counters->nodes_visited += nodes_visited;
 }
@@ -1,45 +1,187 @@
-#ifndef KD_TREE
-#define KD_TREE
+#ifndef KD_TREE_H
+#define KD_TREE_H
 
 #include <vector>
 #include <memory>
+#include <cstdint>
 
+#include "acceleration_structure.h"
 #include "primitive.h"
 #include "geometry.h"
+#include "thread_pool.h"
 
 namespace ray_tracing
 {
 
-struct Node
+//8 byte node of the flattened tree. Nodes are stored depth-first, so the left child
+//of an interior node immediately follows it and only the right one is referenced by index
+class Node
 {
-    Box box;
-    std::vector<std::shared_ptr<Primitive>> contents;
-    std::shared_ptr<Node> left, right;
+private:
+    static const uint32_t LEAF = Point::AXIS_SIZE;
+    static const uint32_t FLAGS_BITS = 2;
+
+    union
+    {
+        float splitting_plane;
+        uint32_t primitives_offset;
+    };
+    //lower FLAGS_BITS bits hold the splitting axis or LEAF,
+    //the upper ones hold the right child index or the number of primitives
+    uint32_t flags;
+
+public:
+    static Node interior(Point::Axis axis, float splitting_plane)
+    {
+        Node node;
+        node.splitting_plane = splitting_plane;
+        node.flags = axis;
+
+        return node;
+    }
+    static Node leaf(uint32_t primitives_offset, uint32_t primitives_num)
+    {
+        Node node;
+        node.primitives_offset = primitives_offset;
+        node.flags = LEAF | (primitives_num << FLAGS_BITS);
+
+        return node;
+    }
+
+    void set_right(uint32_t right)
+    {
+        flags |= right << FLAGS_BITS;
+    }
+    //relocates the node when its subtree is appended to another one
+    void shift(uint32_t nodes_shift, uint32_t primitives_shift)
+    {
+        if(is_leaf())
+            primitives_offset += primitives_shift;
+        else
+            flags += nodes_shift << FLAGS_BITS;
+    }
+
+    bool is_leaf() const
+    {
+        return (flags & LEAF) == LEAF;
+    }
+    Point::Axis axis() const
+    {
+        return Point::Axis(flags & LEAF);
+    }
+    float plane() const
+    {
+        return splitting_plane;
+    }
+    uint32_t right() const
+    {
+        return flags >> FLAGS_BITS;
+    }
+    uint32_t offset() const
+    {
+        return primitives_offset;
+    }
+    uint32_t size() const
+    {
+        return flags >> FLAGS_BITS;
+    }
 };
 
-class Kd_tree
+class Kd_tree : public Acceleration_structure
 {
 private:
-    static const size_t SPLITTING_PLANES_NUM = 3;
+    //splitting planes are looked for among the borders of BINS_NUM equal bins
+    static const size_t BINS_NUM = 32;
+    static const size_t MAX_DEPTH = 64;
+    static const size_t LEAF_SIZE = 2;
+    constexpr static const double TRAVERSAL_COST = 1;
+    constexpr static const double INTERSECTION_COST = 80;
+    //cost reduction for splits cutting off empty space
+    constexpr static const double EMPTY_BONUS = 0.5;
+    //subtrees with at least this number of primitives are built as separate pool tasks
+    static const size_t PARALLEL_BUILD_SIZE = 1 << 12;
+    //nodes with at least this number of primitives are binned and split on several threads
+    static const size_t PARALLEL_SPLIT_SIZE = 1 << 16;
+    //nodes entered by less than 1 / DIVERGENCE_RATIO of the packet rays are traversed by single rays
+    static const size_t DIVERGENCE_RATIO = 4;
+
+    struct Split
+    {
+        Point::Axis axis;
+        float plane;
+        double cost;
+    };
+
+    //part of the tree built independently, its nodes and offsets are relative to its own arrays
+    struct Subtree
+    {
+        std::vector<Node> nodes;
+        std::vector<uint32_t> primitive_indices;
+        size_t leaves_num, depth;
+
+        void append(const Subtree& subtree);
+    };
+
+    //node waiting for traversal and the part of the ray within it
+    struct Todo
+    {
+        uint32_t node;
+        double from, to;
+    };
+    //same for the rays of a packet, a lane not entering the node has from > to
+    struct Packet_todo
+    {
+        uint32_t node;
+        Ray_packet::Lanes from, to;
+    };
 
 private:
-    std::shared_ptr<Node> root;
+    //only used while building
+    Thread_pool* pool;
+    std::vector<Node> nodes;
+    //leaves reference ranges of this array
+    std::vector<uint32_t> primitive_indices;
+    Box box;
+    size_t max_depth, threads_num, fork_depth;
 
-    void build(const std::shared_ptr<Node>& node,
-               const std::vector<std::shared_ptr<Primitive>>& primitives);
+    void build(Subtree& subtree,
+               const Box& node_box,
+               std::vector<uint32_t>&& indices,
+               const std::vector<Box>& bounds,
+               size_t depth) const;
 
-    std::shared_ptr<Primitive> trace(const std::shared_ptr<Node>& node, const Ray& ray) const;
+    Split find_split(const Box& node_box,
+                     const std::vector<uint32_t>& indices,
+                     const std::vector<Box>& bounds) const;
 
-    std::array<std::vector<std::shared_ptr<Primitive>>, 2>
-        split(const std::vector<std::shared_ptr<Primitive>>& primitives,
-              Point::Axis axis, double splitiing_plane) const;
+    std::array<std::vector<uint32_t>, 2>
+        split(const std::vector<uint32_t>& indices,
+              const std::vector<Box>& bounds,
+              Point::Axis axis, double splitting_plane) const;
+
+    //traverses the subtree of start, result and limit are updated in place. Nodes and leaves
+    //are counted if counters are given
+    void traverse(const Ray& ray,
+                  const Todo& start,
+                  double& limit,
+                  Intersection& result,
+                  bool any_hit,
+                  Render_statistics* counters) const;
+
+    virtual Intersection traverse(const Ray& ray, double max_coefficient, bool any_hit) const override;
+    //the rays go down the tree together while they agree on the order of the children,
+    //the ones left of a packet diverging go on their own
+    virtual void traverse(const Ray_packet& packet,
+                          std::array<Intersection, Ray_packet::SIZE>& result) const override;
 
 public:
-    Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives);
-    std::shared_ptr<Primitive> trace(const Ray& ray) const;
+    Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives, Thread_pool& pool);
+    //reads a tree written by save
+    Kd_tree(const std::vector<std::shared_ptr<Primitive>>& primitives, Cache_reader& reader);
+
+    virtual void save(Cache_writer& writer) const override;
 };
 
 }
 
-#endif // KD_TREE
-
+#endif // KD_TREE_H
@@ -1,20 +1,33 @@
-#include <fstream>
+#include <iostream>
+#include <exception>
+#include <memory>
 
 #include "main_window.h"
 #include "parser.h"
 #include "tracer.h"
+#include "thread_pool.h"
 
 int main(int argc, char *argv[])
 {
-    std::fstream in("input.rt", std::ios_base::in);
+    std::shared_ptr<ray_tracing::Thread_pool> pool = std::make_shared<ray_tracing::Thread_pool>();
+    ray_tracing::Scene scene;
 
-    ray_tracing::Matrix result(ray_tracing::Tracer(ray_tracing::parse(in)).produce_picture());
+    try
+    {
+        scene = ray_tracing::parse_file("input.rt", *pool, "input.rt.cache");
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
 
-    in.close();
+    ray_tracing::Tracer tracer(std::move(scene), pool);
 
     QApplication a(argc, argv);
 
-    ray_tracing::Main_window w(result);
+    //the picture is rendered in the background and shown as it is refined
+    ray_tracing::Main_window w(tracer);
 
     w.show();
 
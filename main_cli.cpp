@@ -0,0 +1,201 @@
+#include <iostream>
+#include <exception>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <memory>
+
+#include "parser.h"
+#include "tracer.h"
+#include "thread_pool.h"
+#include "image_writer.h"
+
+const char* const USAGE =
+    "usage: ray_tracing_cli [options] scene output [scene output ...]\n"
+    "renders each scene into its output, the format is chosen by the extension: png, ppm or pfm\n"
+    "options:\n"
+    "    --width N, --height N   resolution of the pictures, the screen of the scene is kept\n"
+    "    --threads N             rendering threads, all the cores by default\n"
+    "    --pattern P             supersampling pattern: grid, stratified or rotated_grid\n"
+    "    --samples N             supersamples per side of a pixel, at least 2\n"
+    "    --threshold X           color variance above which pixels are supersampled\n"
+    "    --budget MS             renders the best picture achievable in MS milliseconds\n"
+    "    --cache                 keeps the parsed geometry of a scene in <scene>.cache\n"
+    "    --statistics            prints statistics of every picture as a JSON object\n";
+
+//settings given on the command line, unset ones are taken from the scenes
+struct Options
+{
+    size_t width = 0, height = 0, threads = std::thread::hardware_concurrency();
+    bool pattern_set = false, samples_set = false, threshold_set = false;
+    ray_tracing::Sample_pattern pattern;
+    size_t samples;
+    double threshold;
+    //milliseconds, 0 for a complete picture at full quality
+    size_t budget = 0;
+    bool cache = false, statistics = false;
+    std::vector<std::string> files;
+};
+
+//option values are read as scene tokens, so they are checked the same way.
+//A value which isn't valid is reported with the message
+template<typename T, typename F>
+T option_value(int argc, char* argv[], int& i, F valid, const std::string& message)
+{
+    std::string name = argv[i];
+
+    if(++i == argc)
+        throw std::runtime_error(name + " needs a value");
+
+    std::string value = argv[i];
+    ray_tracing::Tokenizer tokenizer(value.data(), value.data() + value.size(), name);
+    T result;
+    ray_tracing::read(tokenizer, result);
+
+    if(!tokenizer.at_end())
+        tokenizer.error("unexpected '" + std::string(tokenizer.token()) + "'");
+    if(!valid(result))
+        tokenizer.error(message);
+
+    return result;
+}
+
+template<typename T>
+T option_value(int argc, char* argv[], int& i)
+{
+    return option_value<T>(argc, argv, i, [](const T&) {return true;}, std::string());
+}
+
+Options parse_options(int argc, char* argv[])
+{
+    Options result;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+
+        if(argument == "--width")
+            result.width = option_value<size_t>(argc, argv, i);
+        else if(argument == "--height")
+            result.height = option_value<size_t>(argc, argv, i);
+        else if(argument == "--threads")
+            result.threads = option_value<size_t>(argc, argv, i);
+        else if(argument == "--pattern")
+        {
+            result.pattern = option_value<ray_tracing::Sample_pattern>(argc, argv, i);
+            result.pattern_set = true;
+        }
+        else if(argument == "--samples")
+        {
+            result.samples = option_value<size_t>(argc, argv, i,
+                                                  [](size_t samples) {return samples >= 2;},
+                                                  "samples are to be at least 2");
+            result.samples_set = true;
+        }
+        else if(argument == "--threshold")
+        {
+            result.threshold = option_value<double>(argc, argv, i);
+            result.threshold_set = true;
+        }
+        else if(argument == "--budget")
+            result.budget = option_value<size_t>(argc, argv, i);
+        else if(argument == "--cache")
+            result.cache = true;
+        else if(argument == "--statistics")
+            result.statistics = true;
+        else if(argument.size() > 2 && argument.compare(0, 2, "--") == 0)
+            throw std::runtime_error("unknown option " + argument);
+        else
+            result.files.push_back(argument);
+    }
+
+    if(result.files.empty() || result.files.size() % 2 != 0)
+        throw std::runtime_error("scenes and outputs are to be given in pairs");
+    if(result.threads == 0)
+        result.threads = 1;
+
+    return result;
+}
+
+//the pool is shared by the parsing and the rendering of every scene
+void render(const Options& options,
+            const std::shared_ptr<ray_tracing::Thread_pool>& pool,
+            const std::string& input,
+            const std::string& output)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ray_tracing::Scene scene = ray_tracing::parse_file(input, *pool, options.cache ? input + ".cache" : "");
+
+    ray_tracing::Viewport viewport = scene.get_viewport();
+    viewport.width = options.width == 0 ? viewport.width : options.width;
+    viewport.height = options.height == 0 ? viewport.height : options.height;
+    scene.set_viewport(viewport);
+
+    ray_tracing::Anti_aliasing anti_aliasing = scene.get_anti_aliasing();
+    anti_aliasing.pattern = options.pattern_set ? options.pattern : anti_aliasing.pattern;
+    anti_aliasing.samples = options.samples_set ? options.samples : anti_aliasing.samples;
+    anti_aliasing.threshold = options.threshold_set ? options.threshold : anti_aliasing.threshold;
+    scene.set_anti_aliasing(anti_aliasing);
+
+    ray_tracing::Tracer tracer(std::move(scene), pool);
+    tracer.collect_statistics(options.statistics);
+
+    ray_tracing::Render_control control;
+
+    //the budget is counted from the start of the rendering, the parsing is not included
+    if(options.budget != 0)
+        control.set_budget(std::chrono::milliseconds(options.budget));
+
+    ray_tracing::Render_result result = tracer.produce_picture(control);
+    ray_tracing::save_image(result.picture, output);
+
+    std::cerr << output << ": " << viewport.width << "x" << viewport.height << " in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s";
+
+    if(options.budget != 0 && result.block != 1)
+        std::cerr << ", previewed by blocks of " << result.block << "x" << result.block << " pixels";
+    else if(options.budget != 0)
+        std::cerr << ", trace depth " << result.quality.trace_depth
+                  << ", shadow depth " << result.quality.shadow_depth
+                  << (result.quality.supersampling ? ", supersampled" : "");
+
+    std::cerr << std::endl;
+
+    //the pictures are written to files, so the statistics are the only output
+    if(options.statistics)
+        tracer.write_statistics(std::cout);
+}
+
+//renders without a display, the pictures are only written to files
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch(const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl << USAGE;
+        return 2;
+    }
+
+    std::shared_ptr<ray_tracing::Thread_pool> pool = std::make_shared<ray_tracing::Thread_pool>(options.threads);
+    int result = 0;
+
+    for(size_t i = 0; i < options.files.size(); i += 2)
+        try
+        {
+            render(options, pool, options.files[i], options.files[i + 1]);
+        }
+        catch(const std::exception& exception)
+        {
+            std::cerr << exception.what() << std::endl;
+            result = 1;
+        }
+
+    return result;
+}
@@ -1,24 +1,190 @@
+#include <thread>
+
 #include "main_window.h"
 #include "tracer.h"
+#include "instance.h"
+
+const double ray_tracing::Main_window::STEP;
+const double ray_tracing::Main_window::TURN;
+const double ray_tracing::Main_window::DRAG_TURN;
+
+void ray_tracing::Main_window::start_rendering()
+{
+    buffer.restart();
+    control.reset();
+    rendering = std::thread([this]()
+                            {
+                                tracer.produce_picture(buffer, control);
+                            });
+    timer.start(REFRESH_INTERVAL);
+}
+
+void ray_tracing::Main_window::stop_rendering()
+{
+    control.cancel();
+
+    if(rendering.joinable())
+        rendering.join();
+}
+
+void ray_tracing::Main_window::move_camera(const Transform& transform)
+{
+    viewport.view = transform.apply(viewport.view);
+    viewport.left_down = transform.apply(viewport.left_down);
+    viewport.left_up = transform.apply(viewport.left_up);
+    viewport.right_down = transform.apply(viewport.right_down);
+
+    //the rendering thread stops within a packet of rays, it is waited for by the refresh
+    control.cancel();
+    moved = true;
+
+    if(!timer.isActive())
+        timer.start(REFRESH_INTERVAL);
+}
+
+void ray_tracing::Main_window::shift_camera(double right, double up, double forward)
+{
+    Point center = (viewport.left_up + viewport.right_down) / 2;
+    double step = STEP * (center - viewport.view).mod();
+
+    move_camera(Transform::translate((viewport.right_down - viewport.left_down).normalized() * right * step +
+                                     (viewport.left_up - viewport.left_down).normalized() * up * step +
+                                     (center - viewport.view).normalized() * forward * step));
+}
+
+void ray_tracing::Main_window::turn_camera(double yaw, double pitch)
+{
+    //the observer looks through the screen going to the right and up from left_down, so turning
+    //to the right is counterclockwise looking against the up axis and turning up is clockwise
+    //looking against the right one
+    move_camera(Transform::translate(viewport.view) *
+                Transform::rotate(viewport.left_up - viewport.left_down, yaw) *
+                Transform::rotate(viewport.right_down - viewport.left_down, -pitch) *
+                Transform::translate(-viewport.view));
+}
+
+void ray_tracing::Main_window::keyPressEvent(QKeyEvent* event)
+{
+    switch(event->key())
+    {
+    case Qt::Key_W:
+        shift_camera(0, 0, 1);
+        break;
+    case Qt::Key_S:
+        shift_camera(0, 0, -1);
+        break;
+    case Qt::Key_A:
+        shift_camera(-1, 0, 0);
+        break;
+    case Qt::Key_D:
+        shift_camera(1, 0, 0);
+        break;
+    case Qt::Key_R:
+        shift_camera(0, 1, 0);
+        break;
+    case Qt::Key_F:
+        shift_camera(0, -1, 0);
+        break;
+    case Qt::Key_Left:
+        turn_camera(-TURN, 0);
+        break;
+    case Qt::Key_Right:
+        turn_camera(TURN, 0);
+        break;
+    case Qt::Key_Up:
+        turn_camera(0, TURN);
+        break;
+    case Qt::Key_Down:
+        turn_camera(0, -TURN);
+        break;
+    default:
+        QGLWidget::keyPressEvent(event);
+    }
+}
+
+void ray_tracing::Main_window::mousePressEvent(QMouseEvent* event)
+{
+    drag = event->pos();
+}
+
+void ray_tracing::Main_window::mouseMoveEvent(QMouseEvent* event)
+{
+    if(!(event->buttons() & Qt::LeftButton))
+        return;
+
+    //window rows go down, so dragging the mouse down turns the camera down
+    QPoint shift = event->pos() - drag;
+    drag = event->pos();
+
+    turn_camera(shift.x() * DRAG_TURN, -shift.y() * DRAG_TURN);
+}
+
+void ray_tracing::Main_window::wheelEvent(QWheelEvent* event)
+{
+    //a notch of the wheel is 120
+    shift_camera(0, 0, event->delta() / 120.0);
+}
+
+void ray_tracing::Main_window::refresh()
+{
+    //the tracer is only changed between pictures, the tree is kept as the primitives don't change
+    if(moved)
+    {
+        stop_rendering();
+        tracer.set_viewport(viewport);
+        moved = false;
+        start_rendering();
+    }
+
+    //the buffer is checked before collecting, so the tiles published before it was finished are not missed
+    bool finished = buffer.is_finished();
+    std::vector<Tile> collected = buffer.collect(matrix);
+
+    if(finished)
+        timer.stop();
+
+    if(collected.empty())
+        return;
+
+    changed.insert(changed.end(), collected.begin(), collected.end());
+    update();
+}
 
 void ray_tracing::Main_window::paintGL()
 {
-    glClear(GL_COLOR_BUFFER_BIT);
-    glRasterPos2i(0, 0);
+    glBindTexture(GL_TEXTURE_2D, texture);
 
-    GLfloat* data = new GLfloat[matrix.width() * matrix.height() * 3];
+    //tiles are uploaded in place, rows are stride pixels apart
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, matrix.stride());
+    for(const Tile& tile : changed)
+    {
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, tile.row_from);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile.column_from);
+        glTexSubImage2D(GL_TEXTURE_2D, 0,
+                        tile.column_from, tile.row_from,
+                        tile.column_to - tile.column_from, tile.row_to - tile.row_from,
+                        GL_RGB, GL_FLOAT, matrix.data());
+    }
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
-    for(size_t i = 0; i < matrix.height(); ++i)
-        for(size_t j = 0; j < matrix.width(); ++j)
-        {
-            data[3 * (i * matrix.width() + j) + 0] = matrix[i][j].r;
-            data[3 * (i * matrix.width() + j) + 1] = matrix[i][j].g;
-            data[3 * (i * matrix.width() + j) + 2] = matrix[i][j].b;
-        }
+    changed.clear();
 
-    glDrawPixels(matrix.width(), matrix.height(), GL_RGB, GL_FLOAT, data);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    delete[] data;
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_QUADS);
+    glTexCoord2i(0, 0);
+    glVertex2i(0, 0);
+    glTexCoord2i(1, 0);
+    glVertex2i(matrix.width(), 0);
+    glTexCoord2i(1, 1);
+    glVertex2i(matrix.width(), matrix.height());
+    glTexCoord2i(0, 1);
+    glVertex2i(0, matrix.height());
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
 }
 
 void ray_tracing::Main_window::initializeGL()
@@ -32,17 +198,44 @@ void ray_tracing::Main_window::initializeGL()
 
     glShadeModel(GL_FLAT);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    //the texture starts black, colors are clamped to [0, 1] as they are uploaded
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, matrix.stride());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, matrix.width(), matrix.height(), 0, GL_RGB, GL_FLOAT, matrix.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
 void ray_tracing::Main_window::resizeGL(int new_width, int new_height)
 {
     glViewport(0, 0, new_width, new_height);
-
-    glPixelZoom(double(new_width) / matrix.width(), double(new_height) / matrix.height());
 }
 
-ray_tracing::Main_window::Main_window(const Matrix& matrix, QWidget *parent)
-    : QGLWidget(parent), matrix(matrix)
+ray_tracing::Main_window::Main_window(Tracer& tracer, QWidget *parent)
+    : QGLWidget(parent),
+      tracer(tracer),
+      buffer(tracer.get_viewport().height, tracer.get_viewport().width),
+      matrix(buffer.height(), buffer.width()),
+      texture(0),
+      viewport(tracer.get_viewport()),
+      moved(false)
 {
     resize(QDesktopWidget().availableGeometry(this).size());
+    setFocusPolicy(Qt::StrongFocus);
+
+    connect(&timer, SIGNAL(timeout()), this, SLOT(refresh()));
+    start_rendering();
+}
+
+ray_tracing::Main_window::~Main_window()
+{
+    stop_rendering();
+
+    makeCurrent();
+    glDeleteTextures(1, &texture);
 }
@@ -1,29 +1,82 @@
 #ifndef MAIN_WINDOW_H
 #define MAIN_WINDOW_H
 
+#include <vector>
+#include <thread>
+
 #include <QMainWindow>
 #include <QGLWidget>
 #include <QtOpenGL>
 #include <QTimer>
+#include <QPoint>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
 
 #include "tracer.h"
+#include "picture_buffer.h"
+#include "instance.h"
+#include "render_control.h"
 
 namespace ray_tracing
 {
 
+//shows the picture of the tracer while it is rendered. The tiles published to the buffer are collected
+//on a timer and uploaded to a texture kept for the whole life of the window.
+//The camera is moved by W, A, S, D, R, F and the wheel and turned by the arrows and dragging the mouse.
+//A move cancels the picture being rendered at once, the next one is started from the coarsest preview
+//on the next look at the buffer, so that the moves made meanwhile restart the picture only once
 class Main_window : public QGLWidget
 {
     Q_OBJECT
 
 public:
-    Main_window(const Matrix& matrix, QWidget *parent = 0);
+    Main_window(Tracer& tracer, QWidget *parent = 0);
+    ~Main_window();
+
+private slots:
+    void refresh();
 
 private:
+    //milliseconds between looks at the buffer
+    static const int REFRESH_INTERVAL = 40;
+    //the camera moves by STEP of the distance from the observer to the center of the screen
+    static constexpr double STEP = 0.1;
+    //degrees the camera turns by per key press and per pixel the mouse is dragged by
+    static constexpr double TURN = 5;
+    static constexpr double DRAG_TURN = 0.2;
+
+    Tracer& tracer;
+    Picture_buffer buffer;
     Matrix matrix;
+    //tiles collected but not yet uploaded
+    std::vector<Tile> changed;
+    QTimer timer;
+    GLuint texture;
+    std::thread rendering;
+    //cancels the picture being rendered when the camera moves
+    Render_control control;
+    //the camera as moved, it is set to the tracer when the picture is restarted
+    Viewport viewport;
+    bool moved;
+    QPoint drag;
+
+    void start_rendering();
+    void stop_rendering();
+    //applies the transform to the observer and the screen, the picture is restarted on the next refresh
+    void move_camera(const Transform& transform);
+    //moves the camera by the steps along its right, up and forward axes
+    void shift_camera(double right, double up, double forward);
+    //turns the camera around the observer, yaw to the right and pitch up are positive
+    void turn_camera(double yaw, double pitch);
 
     void initializeGL();
     void paintGL();
     void resizeGL(int new_width, int new_height);
+    void keyPressEvent(QKeyEvent* event);
+    void mousePressEvent(QMouseEvent* event);
+    void mouseMoveEvent(QMouseEvent* event);
+    void wheelEvent(QWheelEvent* event);
 };
 
 }
@@ -0,0 +1,66 @@
+#include <string>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+
+ray_tracing::Mapped_file::Mapped_file(const std::string& file)
+{
+    std::ifstream in(file, std::ios_base::in | std::ios_base::binary);
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    opened = in.is_open();
+    data_ = buffer.data();
+    size_ = buffer.size();
+}
+
+ray_tracing::Mapped_file::~Mapped_file()
+{}
+
+#else
+
+ray_tracing::Mapped_file::Mapped_file(const std::string& file)
+    : data_(nullptr), size_(0), opened(false)
+{
+    int descriptor = open(file.c_str(), O_RDONLY);
+    if(descriptor == -1)
+        return;
+
+    struct stat status;
+    if(fstat(descriptor, &status) == 0)
+    {
+        opened = true;
+
+        if(status.st_size > 0)
+        {
+            void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+            if(mapping != MAP_FAILED)
+            {
+                data_ = static_cast<const char*>(mapping);
+                size_ = status.st_size;
+            }
+            else
+                opened = false;
+        }
+    }
+
+    close(descriptor);
+}
+
+ray_tracing::Mapped_file::~Mapped_file()
+{
+    if(data_)
+        munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
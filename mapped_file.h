@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace ray_tracing
+{
+
+//read-only contents of a whole file, mapped into memory where the platform allows it
+class Mapped_file
+{
+private:
+    const char* data_;
+    size_t size_;
+    bool opened;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+
+public:
+    Mapped_file(const std::string& file);
+    ~Mapped_file();
+
+    Mapped_file(const Mapped_file&) = delete;
+    Mapped_file& operator=(const Mapped_file&) = delete;
+
+    bool is_open() const
+    {
+        return opened;
+    }
+    const char* data() const
+    {
+        return data_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+};
+
+}
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,221 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#include "mesh_loader.h"
+#include "mapped_file.h"
+#include "parser.h"
+
+//indices of a position, a texture coordinate and a normal, NONE for the missing ones
+struct Corner
+{
+    static const uint32_t NONE = UINT32_MAX;
+
+    uint32_t position, uv, normal;
+
+    bool operator==(const Corner& corner) const
+    {
+        return position == corner.position && uv == corner.uv && normal == corner.normal;
+    }
+};
+
+struct Corner_hash
+{
+    size_t operator()(const Corner& corner) const
+    {
+        uint64_t x = (uint64_t(corner.position) * 0x9e3779b97f4a7c15ull) ^
+                     (uint64_t(corner.uv) * 0xbf58476d1ce4e5b9ull) ^
+                     corner.normal;
+
+        return x ^ (x >> 31);
+    }
+};
+
+//index of an OBJ face corner: 1-based, or negative counting back from the last element read
+uint32_t obj_index(ray_tracing::Tokenizer& line, std::string_view text, size_t size)
+{
+    long long index = 0;
+    std::from_chars_result read = std::from_chars(text.data(), text.data() + text.size(), index);
+
+    if(read.ec != std::errc() || read.ptr != text.data() + text.size())
+        line.error("expected an index, found '" + std::string(text) + "'");
+
+    long long result = index < 0 ? static_cast<long long>(size) + index : index - 1;
+
+    if(index == 0 || result < 0 || result >= static_cast<long long>(size))
+        line.error("index " + std::string(text) + " is out of range");
+
+    return result;
+}
+
+std::shared_ptr<const ray_tracing::Mesh_buffers> ray_tracing::load_obj(const std::string& file)
+{
+    Mapped_file mapped(file);
+
+    if(!mapped.is_open())
+        throw std::runtime_error("can't open " + file);
+
+    const char  *begin = mapped.data(),
+                *end = begin + mapped.size();
+
+    Tokenizer text(begin, end, file);
+
+    std::vector<std::array<double, Point::AXIS_SIZE>> positions, normals;
+    std::vector<std::array<double, 2>> uvs;
+    //corners of the triangles, three per triangle
+    std::vector<Corner> corners;
+
+    for(const char* line_begin = begin; line_begin != end; )
+    {
+        const char* line_end = static_cast<const char*>(memchr(line_begin, '\n', end - line_begin));
+        if(!line_end)
+            line_end = end;
+
+        Tokenizer line = text.part(line_begin, line_end);
+        line_begin = line_end == end ? end : line_end + 1;
+
+        if(line.at_end())
+            continue;
+
+        std::string_view keyword = line.token();
+
+        if(keyword == "v")
+            positions.push_back({line.number<double>(), line.number<double>(), line.number<double>()});
+        else if(keyword == "vn")
+            normals.push_back({line.number<double>(), line.number<double>(), line.number<double>()});
+        else if(keyword == "vt")
+            uvs.push_back({line.number<double>(), line.number<double>()});
+        else if(keyword == "f")
+        {
+            std::vector<Corner> face;
+
+            while(!line.at_end())
+            {
+                std::string_view token = line.token();
+                Corner corner{Corner::NONE, Corner::NONE, Corner::NONE};
+
+                size_t first = token.find('/');
+                corner.position = obj_index(line, token.substr(0, first), positions.size());
+
+                if(first != std::string_view::npos)
+                {
+                    size_t second = token.find('/', first + 1);
+                    std::string_view uv = token.substr(first + 1, second - first - 1);
+
+                    if(!uv.empty())
+                        corner.uv = obj_index(line, uv, uvs.size());
+                    if(second != std::string_view::npos)
+                        corner.normal = obj_index(line, token.substr(second + 1), normals.size());
+                }
+
+                face.push_back(corner);
+            }
+
+            if(face.size() < 3)
+                line.error("a face has less than 3 vertices");
+
+            for(size_t i = 1; i + 1 < face.size(); ++i)
+                corners.insert(corners.end(), {face[0], face[i], face[i + 1]});
+        }
+        //comments, groups, materials, free-form geometry and the other statements don't affect the mesh
+    }
+
+    if(corners.empty())
+        throw std::runtime_error(file + " has no faces");
+
+    bool    has_uvs = true,
+            has_normals = true;
+
+    for(const Corner& corner : corners)
+    {
+        has_uvs &= corner.uv != Corner::NONE;
+        has_normals &= corner.normal != Corner::NONE;
+    }
+
+    std::shared_ptr<Mesh_buffers> result = std::make_shared<Mesh_buffers>();
+    result->indices.reserve(corners.size());
+    result->source = file;
+
+    //without normals and uvs the positions are the vertices, otherwise a vertex is made
+    //of each distinct combination of the indices
+    if(!has_uvs && !has_normals)
+    {
+        for(size_t axis = 0; axis < Point::AXIS_SIZE; ++axis)
+            for(const std::array<double, Point::AXIS_SIZE>& position : positions)
+                result->positions[axis].push_back(position[axis]);
+
+        for(const Corner& corner : corners)
+            result->indices.push_back(corner.position);
+
+        return result;
+    }
+
+    std::unordered_map<Corner, uint32_t, Corner_hash> vertices;
+
+    for(Corner corner : corners)
+    {
+        if(!has_uvs)
+            corner.uv = Corner::NONE;
+        if(!has_normals)
+            corner.normal = Corner::NONE;
+
+        std::pair<std::unordered_map<Corner, uint32_t, Corner_hash>::iterator, bool> inserted =
+            vertices.emplace(corner, vertices.size());
+
+        if(inserted.second)
+        {
+            for(size_t axis = 0; axis < Point::AXIS_SIZE; ++axis)
+            {
+                result->positions[axis].push_back(positions[corner.position][axis]);
+
+                if(has_normals)
+                    result->normals[axis].push_back(normals[corner.normal][axis]);
+            }
+
+            if(has_uvs)
+                for(size_t k = 0; k < 2; ++k)
+                    result->uvs[k].push_back(uvs[corner.uv][k]);
+        }
+
+        result->indices.push_back(inserted.first->second);
+    }
+
+    return result;
+}
+
+std::shared_ptr<const ray_tracing::Mesh_buffers> ray_tracing::Mesh_cache::load(const std::string& file)
+{
+    std::promise<Buffers> promise;
+    std::shared_future<Buffers> buffers;
+    bool loaded;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, std::shared_future<Buffers>>::iterator it = meshes.find(file);
+
+        loaded = it != meshes.end();
+        if(loaded)
+            buffers = it->second;
+        else
+            meshes.emplace(file, buffers = promise.get_future().share());
+    }
+
+    if(loaded)
+        return buffers.get();
+
+    try
+    {
+        promise.set_value(load_obj(file));
+    }
+    catch(...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+
+    return buffers.get();
+}
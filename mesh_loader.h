@@ -0,0 +1,37 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+
+#include "triangle_mesh.h"
+
+namespace ray_tracing
+{
+
+//reads vertices, texture coordinates, normals and faces of a Wavefront OBJ file, the other statements
+//are ignored. Polygons are split into triangle fans. Normals and uvs are kept only if every corner
+//of every face has them. Throws Parse_error for malformed lines and std::runtime_error if the file
+//can't be read or has no faces
+std::shared_ptr<const Mesh_buffers> load_obj(const std::string& file);
+
+//each file is loaded once, meshes loaded from the same path share their buffers.
+//The cache may be used from several threads, a file is read outside the lock as textures are
+class Mesh_cache
+{
+private:
+    typedef std::shared_ptr<const Mesh_buffers> Buffers;
+
+    std::map<std::string, std::shared_future<Buffers>> meshes;
+    std::mutex mutex;
+
+public:
+    std::shared_ptr<const Mesh_buffers> load(const std::string& file);
+};
+
+}
+
+#endif // MESH_LOADER_H
@@ -0,0 +1,192 @@
+#include <cmath>
+#include <limits>
+
+#include "packet.h"
+#include "geometry.h"
+
+ray_tracing::Ray_packet::Ray_packet(const std::array<Ray, SIZE>& rays_, size_t size)
+    : rays(rays_),
+      size(size)
+{
+    for(size_t i = size; i < SIZE; ++i)
+        rays[i] = rays[0];
+
+    for(size_t i = 0; i < SIZE; ++i)
+    {
+        Point ray_guiding = rays[i].guiding();
+
+        for(size_t j = 0; j < Point::AXIS_SIZE; ++j)
+        {
+            begin[j][i] = rays[i].begin[j];
+            guiding[j][i] = ray_guiding[j];
+            inverse[j][i] = 1 / ray_guiding[j];
+        }
+
+        shears[i] = Ray_shear(rays[i]);
+        shear_x[i] = shears[i].sx;
+        shear_y[i] = shears[i].sy;
+        shear_z[i] = shears[i].sz;
+    }
+
+    same_axes = true;
+    for(size_t i = 1; i < SIZE; ++i)
+        same_axes &= shears[i].kz == shears[0].kz && shears[i].kx == shears[0].kx;
+}
+
+//vertex sheared by the ray of the lane, the same way as by Ray_shear::apply
+struct Lane_vertex
+{
+    double x, y, z;
+};
+
+//begins of the rays along the axes permuted as the rays share, with the shears of the lanes
+struct Lane_shear
+{
+    const double *x, *y, *z;
+    const double *sx, *sy, *sz;
+
+    Lane_shear(const ray_tracing::Ray_packet& packet, const ray_tracing::Ray_shear& axes)
+        : x(packet.begin[axes.kx].data()), y(packet.begin[axes.ky].data()), z(packet.begin[axes.kz].data()),
+          sx(packet.shear_x.data()), sy(packet.shear_y.data()), sz(packet.shear_z.data())
+    {}
+
+    //takes the vertex with the axes permuted
+    Lane_vertex apply(size_t i, const ray_tracing::Point& vertex) const
+    {
+        double  tx = vertex.x() - x[i],
+                ty = vertex.y() - y[i],
+                tz = vertex.z() - z[i];
+
+        return Lane_vertex{tx - sx[i] * tz, ty - sy[i] * tz, sz[i] * tz};
+    }
+};
+
+inline double lane_edge_function(const Lane_vertex& a, const Lane_vertex& b)
+{
+    return b.x * a.y - b.y * a.x;
+}
+
+inline double scalar_coefficient(const ray_tracing::Ray_shear& shear, const std::array<ray_tracing::Point, 3>& points)
+{
+    return ray_tracing::triangle_coefficient(shear, points[0], points[1], points[2]);
+}
+inline double scalar_coefficient(const ray_tracing::Ray_shear& shear, const std::array<ray_tracing::Point, 4>& points)
+{
+    return ray_tracing::parallelogramm_coefficient(shear, points);
+}
+
+//the watertight test of a triangle (N = 3) or a parallelogramm (N = 4) by lanes. The loop body is
+//mask arithmetic without branches, and the lanes are written to a local array, so that the loop is compiled
+//into SSE/AVX code without checks of aliasing. The rays are expected to share the permutation of the axes,
+//lanes with an edge function of zero are marked by NaN and tested again by the scalar test,
+//which recomputes it in higher precision
+template<size_t N>
+void watertight_coefficients(const ray_tracing::Ray_packet& packet,
+                             const std::array<ray_tracing::Point, N>& points,
+                             ray_tracing::Ray_packet::Lanes& coefficients)
+{
+    using ray_tracing::Ray_packet;
+
+    const double INEXACT = std::numeric_limits<double>::quiet_NaN();
+
+    const ray_tracing::Ray_shear& axes = packet.shears[0];
+    Lane_shear shear(packet, axes);
+
+    std::array<ray_tracing::Point, N> permuted;
+    for(size_t j = 0; j < N; ++j)
+        permuted[j] = ray_tracing::Point(points[j][axes.kx], points[j][axes.ky], points[j][axes.kz]);
+
+    Ray_packet::Lanes result;
+
+    for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+    {
+        Lane_vertex a = shear.apply(i, permuted[0]),
+                    b = shear.apply(i, permuted[1]),
+                    c = shear.apply(i, permuted[2]),
+                    d = shear.apply(i, permuted[N - 1]);
+
+        //u, v, w are the edge functions of the triangle (a, b, c), which gives the depth. A parallelogramm
+        //is bounded by the edges (a, b), (b, c), (c, d), (d, a) instead, a triangle repeats v for the last two
+        double  u = lane_edge_function(b, c),
+                v = lane_edge_function(c, a),
+                w = lane_edge_function(a, b),
+                x = N == 3 ? v : lane_edge_function(c, d),
+                y = N == 3 ? v : lane_edge_function(d, a);
+
+        bool    negative = (u < 0) | (w < 0) | (x < 0) | (y < 0),
+                positive = (u > 0) | (w > 0) | (x > 0) | (y > 0);
+
+        double det = u + v + w;
+        double coefficient = (u * a.z + v * b.z + w * c.z) / det;
+
+        bool inexact = (u == 0) | (v == 0) | (w == 0) | (x == 0) | (y == 0);
+        bool hit = !inexact & !(negative & positive) & (det != 0) & (coefficient > ray_tracing::EPS);
+
+        double miss = inexact ? INEXACT : ray_tracing::Ray::NOWHERE;
+        result[i] = hit ? coefficient : miss;
+    }
+
+    for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+        if(std::isnan(result[i]))
+            result[i] = scalar_coefficient(packet.shears[i], points);
+
+    coefficients = result;
+}
+
+//rays not sharing the permutation of the axes are tested one by one
+void ray_tracing::triangle_coefficients(const Ray_packet& packet,
+                                        const Point& a, const Point& b, const Point& c,
+                                        Ray_packet::Lanes& coefficients)
+{
+    std::array<Point, 3> points{a, b, c};
+
+    if(packet.same_axes)
+        watertight_coefficients(packet, points, coefficients);
+    else
+        for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+            coefficients[i] = scalar_coefficient(packet.shears[i], points);
+}
+
+void ray_tracing::parallelogramm_coefficients(const Ray_packet& packet,
+                                              const std::array<Point, 4>& points,
+                                              Ray_packet::Lanes& coefficients)
+{
+    if(packet.same_axes)
+        watertight_coefficients(packet, points, coefficients);
+    else
+        for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+            coefficients[i] = scalar_coefficient(packet.shears[i], points);
+}
+
+void ray_tracing::sphere_coefficients(const Ray_packet& packet,
+                                      const Point& center, double r,
+                                      Ray_packet::Lanes& coefficients)
+{
+    Ray_packet::Lanes result;
+
+    for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+    {
+        double  gx = packet.guiding[Point::X][i],
+                gy = packet.guiding[Point::Y][i],
+                gz = packet.guiding[Point::Z][i];
+
+        double  ox = packet.begin[Point::X][i] - center.x(),
+                oy = packet.begin[Point::Y][i] - center.y(),
+                oz = packet.begin[Point::Z][i] - center.z();
+
+        double  a = gx * gx + gy * gy + gz * gz,
+                b = ox * gx + oy * gy + oz * gz,
+                c = ox * ox + oy * oy + oz * oz - r * r;
+
+        double discriminant = b * b - a * c;
+        double root = sqrt(fabs(discriminant));
+
+        //the sign of the root is chosen rather than one of two quotients, so that no arithmetic is left to a branch
+        double closer = (-b - root) / a;
+        double coefficient = (-b + (closer > EPS ? -root : root)) / a;
+
+        result[i] = (discriminant > 0) & (coefficient > EPS) ? coefficient : Ray::NOWHERE;
+    }
+
+    coefficients = result;
+}
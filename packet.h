@@ -0,0 +1,46 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <array>
+#include <cstddef>
+
+#include "geometry.h"
+
+namespace ray_tracing
+{
+
+//coherent rays traced together, coordinates are stored by lanes so that
+//the loops over the rays of a packet are vectorized
+struct Ray_packet
+{
+    static const size_t SIZE = 8;
+    typedef std::array<double, SIZE> Lanes;
+
+    std::array<Ray, SIZE> rays;
+    std::array<Lanes, Point::AXIS_SIZE> begin, guiding, inverse;
+    //shears of the rays for the watertight test, their factors by lanes,
+    //and whether the rays share the permutation of the axes so that the lanes are tested together
+    std::array<Ray_shear, SIZE> shears;
+    Lanes shear_x, shear_y, shear_z;
+    bool same_axes;
+    //number of the rays in use, the other lanes repeat the first ray
+    size_t size;
+
+    Ray_packet(const std::array<Ray, SIZE>& rays, size_t size);
+};
+
+//packet versions of triangle_coefficient and parallelogramm_coefficient, the coefficients are the same
+void triangle_coefficients(const Ray_packet& packet,
+                           const Point& a, const Point& b, const Point& c,
+                           Ray_packet::Lanes& coefficients);
+void parallelogramm_coefficients(const Ray_packet& packet,
+                                 const std::array<Point, 4>& points,
+                                 Ray_packet::Lanes& coefficients);
+//packet version of sphere_coefficient
+void sphere_coefficients(const Ray_packet& packet,
+                         const Point& center, double r,
+                         Ray_packet::Lanes& coefficients);
+
+}
+
+#endif // PACKET_H
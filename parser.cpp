@@ -1,133 +1,580 @@
 #include <iostream>
 #include <string>
-#include <assert.h>
+#include <string_view>
+#include <iterator>
+#include <algorithm>
+#include <exception>
+#include <cstring>
 #include <map>
+#include <memory>
 
 #include "parser.h"
 #include "tracer.h"
 #include "picture.h"
 #include "template_utils.h"
+#include "texture_loader.h"
+#include "mesh_loader.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "scene_cache.h"
 
-void ray_tracing::assert_read(std::istream& stream, const std::string& str)
+//first occurrence of word in [from, to) or to, candidates are found with memchr
+const char* search(const char* from, const char* to, std::string_view word)
 {
-    std::string temp;
-    stream >> temp;
+    while(to - from >= ptrdiff_t(word.size()))
+    {
+        from = static_cast<const char*>(memchr(from, word[0], to - from - word.size() + 1));
+
+        if(!from)
+            return to;
+        if(memcmp(from, word.data(), word.size()) == 0)
+            return from;
+
+        ++from;
+    }
+
+    return to;
+}
+
+std::string_view ray_tracing::Tokenizer::token()
+{
+    skip();
+    last = it;
+
+    while(it != end && !isspace(static_cast<unsigned char>(*it)))
+        ++it;
+
+    return std::string_view(last, it - last);
+}
+
+void ray_tracing::Tokenizer::expect(std::string_view expected)
+{
+    std::string_view input = token();
+
+    if(input != expected)
+        error("expected '" + std::string(expected) + "', found '" + std::string(input) + "'");
+}
+
+ray_tracing::Tokenizer ray_tracing::Tokenizer::part(const char* from, const char* to) const
+{
+    Tokenizer result(*this);
+    result.it = result.last = from;
+    result.end = to;
+
+    return result;
+}
+
+const char* ray_tracing::Tokenizer::find(std::string_view word) const
+{
+    for(const char* from = it; ; from += word.size())
+    {
+        from = search(from, end, word);
+
+        if(from == end)
+            return end;
+
+        const char* to = from + word.size();
+
+        if((from == begin || isspace(static_cast<unsigned char>(from[-1]))) &&
+           (to == end || isspace(static_cast<unsigned char>(*to))))
+            return to;
+    }
+}
+
+void ray_tracing::Tokenizer::error(const std::string& message, const char* position) const
+{
+    size_t line = 1 + std::count(begin, position, '\n');
+    const char* line_begin = position;
+
+    while(line_begin != begin && line_begin[-1] != '\n')
+        --line_begin;
+
+    throw Parse_error(source, line, position - line_begin + 1, message);
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, double& x)
+{
+    x = tokenizer.number<double>();
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, size_t& x)
+{
+    x = tokenizer.number<size_t>();
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, std::string& x)
+{
+    x = tokenizer.token();
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, Point& point)
+{
+    point.x() = tokenizer.number<double>();
+    point.y() = tokenizer.number<double>();
+    point.z() = tokenizer.number<double>();
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, Color& color)
+{
+    color.r = tokenizer.number<float>();
+    color.g = tokenizer.number<float>();
+    color.b = tokenizer.number<float>();
+
+    color /= 255;
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, Sample_pattern& pattern)
+{
+    std::string_view name = tokenizer.token();
+
+    if(name == "grid")
+        pattern = Sample_pattern::GRID;
+    else if(name == "stratified")
+        pattern = Sample_pattern::STRATIFIED;
+    else if(name == "rotated_grid")
+        pattern = Sample_pattern::ROTATED_GRID;
+    else
+        tokenizer.error("unknown sample pattern '" + std::string(name) + "'");
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, Filter& filter)
+{
+    std::string_view name = tokenizer.token();
+
+    if(name == "nearest")
+        filter = Filter::NEAREST;
+    else if(name == "bilinear")
+        filter = Filter::BILINEAR;
+    else
+        tokenizer.error("unknown filter '" + std::string(name) + "'");
+}
+
+void ray_tracing::read(Tokenizer& tokenizer, Address& address)
+{
+    std::string_view name = tokenizer.token();
 
-    assert(temp == str);
+    if(name == "wrap")
+        address = Address::WRAP;
+    else if(name == "clamp")
+        address = Address::CLAMP;
+    else
+        tokenizer.error("unknown address mode '" + std::string(name) + "'");
 }
 
-ray_tracing::Scene ray_tracing::parse(std::istream& stream)
+//number of tokens equal to one of the words in [from, to), used to reserve memory for primitives
+size_t count_words(const char* from, const char* to, std::initializer_list<std::string_view> words)
+{
+    size_t result = 0;
+
+    for(std::string_view word : words)
+        for(const char* it = from; (it = search(it, to, word)) != to; it += word.size())
+            ++result;
+
+    return result;
+}
+
+//a geometry block or the body of a group, everything it depends on is known before it is parsed
+struct Geometry_block
+{
+    const char *from, *to;
+    ray_tracing::Sampler sampler;
+    size_t primitives_num;
+    //keyword the block ends with
+    std::string_view closing;
+};
+
+using Groups = std::map<std::string, std::shared_ptr<ray_tracing::Geometry_group>, std::less<>>;
+
+//an instance of a group with its transforms applied in the order they are given
+ray_tracing::Instance parse_instance(ray_tracing::Tokenizer& tokenizer, const Groups& groups)
 {
+    using namespace ray_tracing;
+
+    std::string_view name = tokenizer.token();
+    Groups::const_iterator group = groups.find(name);
+
+    if(group == groups.end())
+        tokenizer.error("unknown group '" + std::string(name) + "'");
+
+    Transform transform;
+    bool overridden = false;
+    Surface<Color> surface;
+
+    while(true)
+    {
+        std::string_view field = tokenizer.token();
+        Point point;
+
+        if(field == "translate")
+        {
+            read(tokenizer, point);
+            transform = Transform::translate(point) * transform;
+        }
+        else if(field == "scale")
+        {
+            read(tokenizer, point);
+            transform = Transform::scale(point) * transform;
+        }
+        else if(field == "rotate")
+        {
+            read(tokenizer, point);
+
+            if(point == Point(0, 0, 0))
+                tokenizer.error("rotation axis is to be nonzero");
+
+            transform = Transform::rotate(point, tokenizer.number<double>()) * transform;
+        }
+        else if(field == "color" && !overridden)
+        {
+            surface = call<Surface<Color>>(Surface<Color>::factory,
+                                           parse<Color, double, double, double>(
+                                                {"color", "alpha", "transparency", "refraction"},
+                                                tokenizer));
+            overridden = true;
+        }
+        else if(field == "endinstance")
+            break;
+        else
+            tokenizer.error("unexpected field '" + std::string(field) + "'");
+    }
+
+    if(transform.determinant() == 0)
+        tokenizer.error("instance transform is degenerate", name.data());
+
+    return overridden ? Instance(group->second, transform, surface) : Instance(group->second, transform);
+}
+
+//groups are given for geometry blocks, they can't be instanced inside groups
+ray_tracing::Scene parse_geometry(ray_tracing::Tokenizer tokenizer,
+                                  const Geometry_block& block,
+                                  ray_tracing::Texture_cache& textures,
+                                  ray_tracing::Mesh_cache& meshes,
+                                  const Groups* groups)
+{
+    using namespace ray_tracing;
+
     Scene scene;
+    scene.reserve_primitives(block.primitives_num);
+
+    while(true)
+    {
+        std::string_view material = tokenizer.token();
+
+        Surface<Color> sc;
+        Surface<Texture> st;
+
+        if(material == "instance")
+        {
+            if(!groups)
+                tokenizer.error("groups can't contain instances");
+
+            scene.add_primitive(parse_instance(tokenizer, *groups));
+            continue;
+        }
+        else if(material == "texture")
+        {
+            std::tuple<std::string, double, double, double> input =
+                parse<std::string, double, double, double>(
+                     {"file", "alpha", "transparency", "refraction"},
+                     tokenizer);
+
+            Texture texture;
+
+            try
+            {
+                texture = textures.load(std::get<0>(input));
+            }
+            catch(const std::runtime_error& exception)
+            {
+                tokenizer.error(exception.what(), material.data());
+            }
+
+            st = Surface<Texture>(texture, std::get<1>(input), std::get<2>(input), std::get<3>(input));
+            st.color.set_sampler(block.sampler);
+        }
+        else if(material == "color")
+        {
+            sc = call<Surface<Color>>(Surface<Color>::factory,
+                                      parse<Color, double, double, double>(
+                                           {"color", "alpha", "transparency", "refraction"},
+                                           tokenizer));
+        }
+        else if(material == block.closing)
+            break;
+        else
+            tokenizer.error("expected a material, found '" + std::string(material) + "'");
+
+        std::string_view primitive = tokenizer.token();
+
+        if(material == "texture" && primitive != "parallelogramm" && primitive != "mesh")
+            tokenizer.error("only parallelogramms and meshes may be textured");
+
+        if(primitive == "triangle")
+        {
+            scene.add_primitive(Triangle(parse_array<Point, 3>(tokenizer, "vertex"), sc));
+        }
+        else if(primitive == "sphere")
+        {
+            std::tuple<Point, double> input = parse<Point, double>({"center", "radius"}, tokenizer);
+
+            scene.add_primitive(Sphere(std::get<0>(input), std::get<1>(input), sc));
+        }
+        else if(primitive == "parallelogramm")
+        {
+            std::array<Point, 3> vertices = parse_array<Point, 3>(tokenizer, "vertex");
+
+            if(material == "texture")
+                scene.add_primitive(Parallelogramm<Texture>(vertices, st));
+            else
+                scene.add_primitive(Parallelogramm<Color>(vertices, sc));
+        }
+        else if(primitive == "mesh")
+        {
+            const char* position = primitive.data();
+            std::string file = std::get<0>(parse<std::string>({"file"}, tokenizer));
+            std::shared_ptr<const Mesh_buffers> buffers;
 
-    std::string temp;
+            //errors inside the mesh file are reported at their own place
+            try
+            {
+                buffers = meshes.load(file);
+            }
+            catch(const Parse_error&)
+            {
+                throw;
+            }
+            catch(const std::runtime_error& exception)
+            {
+                tokenizer.error(exception.what(), position);
+            }
+
+            if(material == "texture")
+                scene.add_primitive(Triangle_mesh(buffers, st));
+            else
+                scene.add_primitive(Triangle_mesh(buffers, sc));
+        }
+        else
+            tokenizer.error("unknown primitive '" + std::string(primitive) + "'");
+    }
 
-    while(stream >> temp)
+    return scene;
+}
+
+//geometry blocks are only located while the rest of the scene is parsed,
+//then they are parsed in parallel and appended in the order of the text
+ray_tracing::Scene parse_text(const char* begin,
+                              const char* end,
+                              const std::string& source,
+                              ray_tracing::Thread_pool& pool,
+                              const std::string& cache)
+{
+    using namespace ray_tracing;
+
+    Scene scene;
+    Tokenizer tokenizer(begin, end, source);
+    //applies to the textures declared after it
+    Sampler sampler;
+    Texture_cache textures;
+    Mesh_cache meshes;
+    std::vector<Geometry_block> blocks;
+    Groups groups;
+
+    while(!tokenizer.at_end())
     {
-        if(temp == "viewport")
+        std::string_view keyword = tokenizer.token();
+
+        if(keyword == "viewport")
         {
             scene.set_viewport(call<Viewport>(Viewport::factory,
                                               parse<Point, Point, Point, Point, size_t, size_t>(
                                                    {"view", "left_down", "left_up", "right_down", "height", "width"},
-                                                   stream)));
+                                                   tokenizer)));
+
+            tokenizer.expect("endviewport");
+        }
+        else if(keyword == "acceleration")
+        {
+            std::string_view name = tokenizer.token();
+
+            if(name == "bvh")
+                scene.set_acceleration(Acceleration::BVH);
+            else if(name == "kd_tree")
+                scene.set_acceleration(Acceleration::KD_TREE);
+            else
+                tokenizer.error("unknown acceleration structure '" + std::string(name) + "'");
+        }
+        else if(keyword == "tile_size")
+        {
+            size_t tile_size = tokenizer.number<size_t>();
+
+            if(tile_size == 0)
+                tokenizer.error("tile size is to be positive");
+
+            scene.set_tile_size(tile_size);
+        }
+        else if(keyword == "anti_aliasing")
+        {
+            Anti_aliasing anti_aliasing = call<Anti_aliasing>(Anti_aliasing::factory,
+                                                              parse<Sample_pattern, size_t, double>(
+                                                                   {"pattern", "samples", "threshold"},
+                                                                   tokenizer));
+
+            if(anti_aliasing.samples < 2)
+                tokenizer.error("samples are to be at least 2");
+
+            scene.set_anti_aliasing(anti_aliasing);
+
+            tokenizer.expect("endanti_aliasing");
+        }
+        else if(keyword == "sampler")
+        {
+            sampler = call<Sampler>(Sampler::factory,
+                                    parse<Filter, Address>(
+                                         {"filter", "address"},
+                                         tokenizer));
+
+            //textures are only mipmapped if asked for
+            std::string_view last = tokenizer.token();
+
+            if(last == "mipmaps")
+            {
+                sampler.mipmaps = Mipmaps::ON;
+                last = tokenizer.token();
+            }
 
-            assert_read(stream, "endviewport");
+            if(last != "endsampler")
+                tokenizer.error("expected 'endsampler', found '" + std::string(last) + "'");
         }
-        else if(temp == "lights")
+        else if(keyword == "lights")
         {
             while(true)
             {
-                stream >> temp;
+                std::string_view light = tokenizer.token();
 
-                if(temp == "point")
+                if(light == "point")
                 {
                     scene.add_light(call<Light>(Light::factory,
-                                                parse<Point, Light::Light_force>(
+                                                parse<Point, double>(
                                                      {"coords", "power"},
-                                                     stream)));
+                                                     tokenizer)));
 
-                    assert_read(stream, "endpoint");
+                    tokenizer.expect("endpoint");
                 }
-                else
-                {
-                    assert(temp == "endlights");
+                else if(light == "endlights")
                     break;
-                }
+                else
+                    tokenizer.error("expected a light, found '" + std::string(light) + "'");
             }
         }
-        else if(temp == "geometry")
+        else if(keyword == "geometry")
         {
-            while(true)
-            {
-                std::string material;
+            const char  *from = tokenizer.position(),
+                        *to = tokenizer.find("endgeometry");
 
-                stream >> material;
+            if(to == end)
+                tokenizer.error("geometry isn't closed with endgeometry");
 
-                Surface<Color> sc;
-                Surface<Texture> st;
+            blocks.push_back(Geometry_block{from, to, sampler,
+                                            count_words(from, to, {"triangle", "sphere", "parallelogramm", "mesh",
+                                                                   "instance"}),
+                                            "endgeometry"});
+            tokenizer = tokenizer.part(to, end);
+        }
+        //groups are parsed right away, as geometry blocks may instance them wherever they are
+        else if(keyword == "group")
+        {
+            std::string_view name = tokenizer.token();
 
-                if(material == "texture")
-                {
-                    st = call<Surface<Texture>>(Surface<Texture>::factory,
-                                                parse<Texture, double, double, double>(
-                                                     {"file", "alpha", "transparency", "refraction"},
-                                                     stream));
-                }
-                else if(material == "color")
-                {
-                    sc = call<Surface<Color>>(Surface<Color>::factory,
-                                              parse<Color, double, double, double>(
-                                                   {"color", "alpha", "transparency", "refraction"},
-                                                   stream));
-                }
-                else
-                {
-                    assert(material == "endgeometry");
-                    break;
-                }
+            if(groups.find(name) != groups.end())
+                tokenizer.error("group '" + std::string(name) + "' is defined twice");
 
-                stream >> temp;
-                if(temp == "triangle")
-                {
-                    scene.add_primitive(Triangle(parse_array<Point, 3>(stream, "vertex"), sc));
-                }
-                else if(temp == "sphere")
-                {
-                    struct Sphere_input
-                    {
-                        Point center;
-                        double r;
-
-                        Sphere_input()
-                        {}
-                        Sphere_input(const Point& center, double r)
-                            : center(center), r(r)
-                        {}
-
-                        static Sphere_input factory(const Point& center, double r)
-                        {
-                            return Sphere_input(center, r);
-                        }
-                    } si;
-
-                    si = call<Sphere_input>(Sphere_input::factory,
-                                            parse<Point, double>(
-                                                 {"center", "radius"},
-                                                 stream));
-
-                    scene.add_primitive(Sphere(si.center, si.r, sc));
-                }
-                else if(temp == "parallelogramm")
-                {
-                    std::array<Point, 3> vertices = parse_array<Point, 3>(stream, "vertex");
-                    if(material == "texture")
-                        scene.add_primitive(Parallelogramm<Texture>(vertices, st));
-                    else if(material == "color")
-                        scene.add_primitive(Parallelogramm<Color>(vertices, sc));
-                }
-            }
+            const char  *from = tokenizer.position(),
+                        *to = tokenizer.find("endgroup");
+
+            if(to == end)
+                tokenizer.error("group isn't closed with endgroup");
+
+            Geometry_block block{from, to, sampler,
+                                 count_words(from, to, {"triangle", "sphere", "parallelogramm", "mesh"}),
+                                 "endgroup"};
+            Scene group = parse_geometry(tokenizer.part(from, to), block, textures, meshes, nullptr);
+
+            groups.emplace(name, std::make_shared<Geometry_group>(group.take_primitives()));
+            tokenizer = tokenizer.part(to, end);
         }
+        else
+            tokenizer.error("unknown keyword '" + std::string(keyword) + "'");
     }
 
+    //instances aren't cached, their groups are cheap to build as they are shared
+    if(!cache.empty() && groups.empty())
+    {
+        uint64_t key = Scene_cache::hash(nullptr, 0);
+
+        for(const Geometry_block& block : blocks)
+        {
+            key = Scene_cache::hash(block.from, block.to - block.from, key);
+            key = Scene_cache::hash(reinterpret_cast<const char*>(&block.sampler), sizeof(block.sampler), key);
+        }
+
+        if(Scene_cache::load(cache, key, scene, textures))
+            return scene;
+    }
+
+    std::vector<Scene> parts(blocks.size());
+    std::vector<std::exception_ptr> errors(blocks.size());
+
+    auto parse_block = [&](size_t i)
+                       {
+                           try
+                           {
+                               parts[i] = parse_geometry(tokenizer.part(blocks[i].from, blocks[i].to),
+                                                         blocks[i],
+                                                         textures,
+                                                         meshes,
+                                                         &groups);
+                           }
+                           catch(...)
+                           {
+                               errors[i] = std::current_exception();
+                           }
+                       };
+
+    if(blocks.size() > 1)
+        pool.parallel_for(blocks.size(), parse_block);
+    else if(blocks.size() == 1)
+        parse_block(0);
+
+    //the first error in the text is reported
+    for(const std::exception_ptr& error : errors)
+        if(error)
+            std::rethrow_exception(error);
+
+    size_t primitives_num = 0;
+    for(const Geometry_block& block : blocks)
+        primitives_num += block.primitives_num;
+
+    scene.reserve_primitives(primitives_num);
+
+    for(Scene& part : parts)
+        scene.append(std::move(part));
+
     return scene;
 }
+
+ray_tracing::Scene ray_tracing::parse(std::istream& stream, Thread_pool& pool)
+{
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    return parse_text(text.data(), text.data() + text.size(), "<stream>", pool, "");
+}
+
+ray_tracing::Scene ray_tracing::parse_file(const std::string& file, Thread_pool& pool, const std::string& cache)
+{
+    Mapped_file mapped(file);
+
+    if(!mapped.is_open())
+        throw std::runtime_error("can't open " + file);
+
+    return parse_text(mapped.data(), mapped.data() + mapped.size(), file, pool, cache);
+}
@@ -5,15 +5,116 @@
 #include <type_traits>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <stdexcept>
+#include <charconv>
+#include <cctype>
+#include <array>
 
 #include "tracer.h"
+#include "texture.h"
 #include "geometry.h"
 
-//parsing is performed without error handler
-
 namespace ray_tracing
 {
 
+class Parse_error : public std::runtime_error
+{
+private:
+    size_t line, column;
+
+public:
+    Parse_error(const std::string& source, size_t line, size_t column, const std::string& message)
+        : std::runtime_error(source + ":" + std::to_string(line) + ":" + std::to_string(column) + ": " + message),
+          line(line),
+          column(column)
+    {}
+
+    size_t get_line() const
+    {
+        return line;
+    }
+    size_t get_column() const
+    {
+        return column;
+    }
+};
+
+//splits the text of a scene held in memory into whitespace separated tokens
+class Tokenizer
+{
+private:
+    //begin is kept to find line and column of errors
+    const char *begin, *it, *end;
+    //beginning of the last token read
+    const char* last;
+    std::string source;
+
+public:
+    Tokenizer(const char* begin, const char* end, const std::string& source)
+        : begin(begin), it(begin), end(end), last(begin), source(source)
+    {}
+
+    void skip()
+    {
+        while(it != end && isspace(static_cast<unsigned char>(*it)))
+            ++it;
+    }
+    bool at_end()
+    {
+        skip();
+        return it == end;
+    }
+    std::string_view token();
+    void expect(std::string_view expected);
+    template<typename T>
+    T number();
+
+    const char* position() const
+    {
+        return it;
+    }
+    //tokenizer of [from, to) reporting errors relatively to the whole text
+    Tokenizer part(const char* from, const char* to) const;
+    //position right after the next token equal to word, end if there is none
+    const char* find(std::string_view word) const;
+
+    [[noreturn]] void error(const std::string& message) const
+    {
+        error(message, last);
+    }
+    [[noreturn]] void error(const std::string& message, const char* position) const;
+};
+
+template<typename T>
+T Tokenizer::number()
+{
+    skip();
+    last = it;
+
+    T result{};
+    std::from_chars_result read = std::from_chars(it, end, result);
+
+    if(read.ec != std::errc() || (read.ptr != end && !isspace(static_cast<unsigned char>(*read.ptr))))
+    {
+        std::string_view input = token();
+        error("expected a number, found '" + std::string(input) + "'");
+    }
+
+    it = read.ptr;
+
+    return result;
+}
+
+void read(Tokenizer& tokenizer, double& x);
+void read(Tokenizer& tokenizer, size_t& x);
+void read(Tokenizer& tokenizer, std::string& x);
+void read(Tokenizer& tokenizer, Point& point);
+void read(Tokenizer& tokenizer, Color& color);
+void read(Tokenizer& tokenizer, Sample_pattern& pattern);
+void read(Tokenizer& tokenizer, Filter& filter);
+void read(Tokenizer& tokenizer, Address& address);
+
 template<size_t I = 0, typename Functor, typename... T>
 typename std::enable_if<I == sizeof...(T), void>::type
     for_index(size_t, Functor, std::tuple<T...>&)
@@ -33,59 +134,67 @@ typename std::enable_if<I < sizeof...(T), void>::type
 class Reader
 {
 private:
-    std::istream& stream;
+    Tokenizer& tokenizer;
 
 public:
-    Reader(std::istream& stream)
-        : stream(stream)
+    Reader(Tokenizer& tokenizer)
+        : tokenizer(tokenizer)
     {}
 
     template<typename T>
     void operator()(T& t)
     {
-        stream >> t;
+        read(tokenizer, t);
     }
 };
 
+//reads named fields given in any order, each of them exactly once
 template<typename... T>
-std::tuple<T...> parse(std::array<std::string, sizeof...(T)> names, std::istream& stream)
+std::tuple<T...> parse(const std::array<const char*, sizeof...(T)>& names, Tokenizer& tokenizer)
 {
     std::tuple<T...> result;
-    std::vector<char> checked(names.size());
+    std::array<bool, sizeof...(T)> checked{};
 
     for(size_t i = 0; i < names.size(); ++i)
     {
-        std::string input;
-        stream >> input;
+        std::string_view input = tokenizer.token();
 
-        size_t number;
-        for(number = 0; checked[number] || names[number] != input; ++number);
+        //fields usually come in the order of names, so the expected one is tried first
+        size_t number = i;
+        if(checked[number] || input != names[number])
+            for(number = 0; number < names.size() && (checked[number] || input != names[number]); ++number);
+
+        if(number == names.size())
+            tokenizer.error("unexpected field '" + std::string(input) + "'");
 
         checked[number] = true;
 
-        for_index(number, Reader(stream), result);
+        for_index(number, Reader(tokenizer), result);
     }
 
     return result;
 }
 
-void assert_read(std::istream& stream, const std::string& str);
-
 template<typename T, size_t N>
-std::array<T, N> parse_array(std::istream& stream, const std::string& keyword)
+std::array<T, N> parse_array(Tokenizer& tokenizer, std::string_view keyword)
 {
     std::array<T, N> result;
 
     for(T& i : result)
     {
-        assert_read(stream, keyword);
-        stream >> i;
+        tokenizer.expect(keyword);
+        read(tokenizer, i);
     }
 
     return result;
 }
 
-Scene parse(std::istream& stream);
+//parse errors are reported with Parse_error, unreadable files with std::runtime_error.
+//If cache is given, the geometry is loaded from it when its text hasn't changed,
+//otherwise it is parsed and stored to the cache once the acceleration structure is built.
+//Geometry blocks are parsed in parallel on the pool, which may be given to the tracer afterwards
+Scene parse(std::istream& stream, Thread_pool& pool);
+Scene parse_file(const std::string& file, Thread_pool& pool, const std::string& cache = "");
 
 }
 
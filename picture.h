@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "geometry.h"
+#include "image.h"
 
 namespace ray_tracing
 {
@@ -75,6 +76,7 @@ struct Surface
     double alpha, transparency, refraction;
 
     Surface()
+        : alpha(0), transparency(0), refraction(1)
     {}
     Surface(const C& color,
             double alpha,
@@ -95,25 +97,10 @@ struct Surface
     }
 };
 
-struct Matrix : public std::vector<std::vector<Color>>
-{
-    typedef std::vector<Color> Row;
+//colors are stored as 3 consecutive floats, so rows of an image can be uploaded as they are
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color is expected to be packed");
 
-    Matrix()
-    {}
-    Matrix(size_t height, size_t width)
-        : std::vector<Row>(height, Row(width))
-    {}
-
-    size_t height() const
-    {
-        return size();
-    }
-    size_t width() const
-    {
-        return (*this)[0].size();
-    }
-};
+typedef Image<Color> Matrix;
 
 struct Viewport
 {
@@ -144,10 +131,6 @@ struct Viewport
     }
 };
 
-typedef Matrix Texture;
-
-std::istream& operator>>(std::istream& stream, Texture& texture);
-
 }
 
 #endif // PICTURE
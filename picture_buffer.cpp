@@ -0,0 +1,47 @@
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "picture_buffer.h"
+
+void copy_tile(const ray_tracing::Matrix& source, ray_tracing::Matrix& target, const ray_tracing::Tile& tile)
+{
+    for(size_t i = tile.row_from; i < tile.row_to; ++i)
+        std::copy(source[i].begin() + tile.column_from,
+                  source[i].begin() + tile.column_to,
+                  target[i].begin() + tile.column_from);
+}
+
+ray_tracing::Picture_buffer::Picture_buffer(size_t height, size_t width)
+    : picture(height, width),
+      finished(false)
+{}
+
+void ray_tracing::Picture_buffer::publish(const Matrix& source, const Tile& tile)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    copy_tile(source, picture, tile);
+    published.push_back(tile);
+}
+
+std::vector<ray_tracing::Tile> ray_tracing::Picture_buffer::collect(Matrix& target)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(const Tile& tile : published)
+        copy_tile(picture, target, tile);
+
+    std::vector<Tile> result;
+    result.swap(published);
+
+    return result;
+}
+
+void ray_tracing::Picture_buffer::restart()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    published.clear();
+    finished = false;
+}
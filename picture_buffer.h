@@ -0,0 +1,65 @@
+#ifndef PICTURE_BUFFER_H
+#define PICTURE_BUFFER_H
+
+#include <vector>
+#include <cstddef>
+#include <mutex>
+#include <atomic>
+
+#include "picture.h"
+#include "image.h"
+
+namespace ray_tracing
+{
+
+//block of pixels rendered as a single task
+struct Tile
+{
+    size_t row_from, row_to, column_from, column_to;
+};
+
+//picture shared by a tracer rendering it progressively and a viewer showing it meanwhile.
+//The tracer publishes tiles as they are refined, the viewer collects the ones published since its previous look.
+//The buffer is restarted for the next picture, e.g. when the camera moves
+class Picture_buffer
+{
+private:
+    std::mutex mutex;
+    Matrix picture;
+    std::vector<Tile> published;
+    std::atomic<bool> finished;
+
+public:
+    Picture_buffer(size_t height, size_t width);
+
+    size_t height() const
+    {
+        return picture.height();
+    }
+    size_t width() const
+    {
+        return picture.width();
+    }
+
+    //copies the tile of the source, which is of the size of the buffer
+    void publish(const Matrix& source, const Tile& tile);
+    //copies the tiles published since the previous call into the target, which is of the size
+    //of the buffer, and returns them
+    std::vector<Tile> collect(Matrix& target);
+
+    //marks the picture as complete, the tiles published before are still to be collected
+    void finish()
+    {
+        finished = true;
+    }
+    bool is_finished() const
+    {
+        return finished;
+    }
+    //prepares the buffer for the next picture, the tiles published are dropped but the pixels are kept
+    void restart();
+};
+
+}
+
+#endif // PICTURE_BUFFER_H
@@ -1,89 +1,128 @@
 #include "primitive.h"
 #include "geometry.h"
 
-ray_tracing::Point ray_tracing::Base_quadrangle::intersect(const Ray& ray) const
+void ray_tracing::Primitive::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
+{
+    for(size_t i = 0; i < Ray_packet::SIZE; ++i)
+        coefficients[i] = intersect(packet.rays[i]);
+}
+
+double ray_tracing::Primitive::intersect(const Ray& ray, double max_coefficient, bool, uint32_t& part) const
+{
+    double coefficient = intersect(ray);
+    part = 0;
+
+    return coefficient < max_coefficient ? coefficient : Ray::NOWHERE;
+}
+
+ray_tracing::Hit ray_tracing::Primitive::hit(const Ray& ray, double coefficient, uint32_t) const
+{
+    return hit(ray, coefficient);
+}
+
+ray_tracing::Box ray_tracing::Primitive::bounds() const
+{
+    Box result;
+
+    for(size_t i = 0; i < Point::AXIS_SIZE; ++i)
+    {
+        result.ld[i] = point(Point::Axis(i), Either::LEFTEST);
+        result.ru[i] = point(Point::Axis(i), Either::RIGHTEST);
+    }
+
+    return result;
+}
+
+double ray_tracing::Base_quadrangle::intersect(const Ray& ray) const
 {
     return Polygon::intersect(ray);
 }
 
+void ray_tracing::Base_quadrangle::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
+{
+    Polygon::intersect(packet, coefficients);
+}
+
+ray_tracing::Hit ray_tracing::Base_quadrangle::hit(const Ray& ray, double coefficient) const
+{
+    return Polygon::hit(ray, coefficient);
+}
+
 double ray_tracing::Base_quadrangle::point(Point::Axis axis, Either either) const
 {
     return Polygon::point(axis, either);
 }
 
-double ray_tracing::Base_quadrangle::angle_cos(const Ray& ray) const
+ray_tracing::Orientation ray_tracing::Base_quadrangle::side(const Ray& ray, const Hit&) const
 {
-    return Polygon::angle_cos(ray);
+    return Polygon::side(ray);
 }
 
-ray_tracing::Orientation ray_tracing::Base_quadrangle::side(const Ray& ray) const
+ray_tracing::Ray ray_tracing::Base_quadrangle::refract(const Ray& ray, const Hit& hit) const
 {
-    return Polygon::side(ray);
+    return Polygon::refract(ray, hit, get_refraction(hit));
 }
 
-ray_tracing::Ray ray_tracing::Base_quadrangle::reflect(const Ray& ray) const
+double ray_tracing::Base_parallelogramm::intersect(const Ray& ray) const
 {
-    return Polygon::reflect(ray);
+    return parallelogramm_coefficient(Ray_shear(ray), get_points());
 }
 
-ray_tracing::Ray ray_tracing::Base_quadrangle::refract(const Ray& ray) const
+void ray_tracing::Base_parallelogramm::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
 {
-    return Polygon::refract(ray, get_refraction());
+    parallelogramm_coefficients(packet, get_points(), coefficients);
 }
 
-ray_tracing::Point ray_tracing::Triangle::intersect(const Ray& ray) const
+double ray_tracing::Triangle::intersect(const Ray& ray) const
 {
     return Polygon::intersect(ray);
 }
 
-double ray_tracing::Triangle::point(Point::Axis axis, Either either) const
+void ray_tracing::Triangle::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
 {
-    return Polygon::point(axis, either);
+    Polygon::intersect(packet, coefficients);
 }
 
-double ray_tracing::Triangle::angle_cos(const Ray& ray) const
+ray_tracing::Hit ray_tracing::Triangle::hit(const Ray& ray, double coefficient) const
 {
-    return Polygon::angle_cos(ray);
+    return Polygon::hit(ray, coefficient);
 }
 
-ray_tracing::Orientation ray_tracing::Triangle::side(const Ray& ray) const
+double ray_tracing::Triangle::point(Point::Axis axis, Either either) const
 {
-    return Polygon::side(ray);
+    return Polygon::point(axis, either);
 }
 
-ray_tracing::Ray ray_tracing::Triangle::reflect(const Ray& ray) const
+ray_tracing::Orientation ray_tracing::Triangle::side(const Ray& ray, const Hit&) const
 {
-    return Polygon::reflect(ray);
+    return Polygon::side(ray);
 }
 
-ray_tracing::Ray ray_tracing::Triangle::refract(const Ray& ray) const
+ray_tracing::Ray ray_tracing::Triangle::refract(const Ray& ray, const Hit& hit) const
 {
-    return Polygon::refract(ray, get_refraction());
+    return Polygon::refract(ray, hit, get_refraction(hit));
 }
 
-ray_tracing::Point ray_tracing::Sphere::intersect(const Ray& ray) const
+double ray_tracing::Sphere::intersect(const Ray& ray) const
 {
-    Point normal = projection(ray.guiding(), center - ray.begin) + ray.begin - center;
-
-    if(!in(center + normal))
-        return Point::NOWHERE;
+    return sphere_coefficient(ray, center, r);
+}
 
-    double c = sqrt(r * r - normal.mod() * normal.mod());
-    std::array<Point, 2> points{center + normal + ray.guiding().normalized() * c,
-                                center + normal - ray.guiding().normalized() * c};
+void ray_tracing::Sphere::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
+{
+    sphere_coefficients(packet, center, r, coefficients);
+}
 
-    double t[2];
-    for(int i = 0; i < 2; ++i)
-        t[i] = ray.coefficient(points[i]);
+ray_tracing::Hit ray_tracing::Sphere::hit(const Ray& ray, double coefficient) const
+{
+    Hit result;
 
-    if(t[0] < t[1])
-        std::swap(t[0], t[1]);
+    result.coefficient = coefficient;
+    result.point = ray.begin + ray.guiding() * coefficient;
+    result.normal = normal(result.point);
+    result.side = side(ray, result);
 
-    if(t[0] == Ray::NOWHERE)
-        return Point::NOWHERE;
-    else
-        return t[1] == Ray::NOWHERE ? ray.begin + ray.guiding() * t[0] :
-                                      ray.begin + ray.guiding() * t[1];
+    return result;
 }
 
 double ray_tracing::Sphere::point(Point::Axis axis, Either either) const
@@ -94,28 +133,15 @@ double ray_tracing::Sphere::point(Point::Axis axis, Either either) const
         return center[axis] + r;
 }
 
-double ray_tracing::Sphere::angle_cos(const Ray& ray) const
-{
-    return fabs(ray_tracing::angle_cos(ray.guiding(), normal(intersect(ray))));
-}
-
-ray_tracing::Orientation ray_tracing::Sphere::side(const Ray& ray) const
+ray_tracing::Orientation ray_tracing::Sphere::side(const Ray& ray, const Hit&) const
 {
     return in(ray.begin) ? Orientation::DOWN : Orientation::UP;
 }
 
-ray_tracing::Ray ray_tracing::Sphere::reflect(const Ray& ray) const
+ray_tracing::Ray ray_tracing::Sphere::refract(const Ray& ray, const Hit& hit) const
 {
-    Point intersection = intersect(ray);
-    return ray_tracing::reflect(ray, intersection, normal(intersection));
-}
-
-ray_tracing::Ray ray_tracing::Sphere::refract(const Ray& ray) const
-{
-    Point intersection = intersect(ray);
     return ray_tracing::refract(ray,
-                                intersection,
-                                normal(intersection),
-                                side(ray) == Orientation::UP ? get_refraction() : 1. / get_refraction());
+                                hit.point,
+                                hit.normal,
+                                hit.side == Orientation::UP ? get_refraction(hit) : 1. / get_refraction(hit));
 }
-
@@ -4,26 +4,64 @@
 #include <cassert>
 
 #include "picture.h"
+#include "texture.h"
 #include "geometry.h"
+#include "packet.h"
 
 namespace ray_tracing
 {
 
 enum class Either{LEFTEST, RIGHTEST};
 
+class Primitive;
+
+//everything shading needs to know about an intersection, computed once per traced ray
+struct Hit
+{
+    double coefficient;
+    Point point, normal;
+    //side of the surface the ray comes from
+    Orientation side;
+    const Primitive* primitive;
+    uint32_t primitive_id;
+    //triangle of a mesh, unused by the other primitives
+    uint32_t part;
+    //primitive of a group hit through the instance in primitive, nullptr for primitives hit directly
+    const Primitive* instanced;
+    //width of the area seen through a pixel around the point, textures are filtered over it
+    double footprint;
+
+    Hit()
+        : coefficient(Ray::NOWHERE), primitive(nullptr), part(0), instanced(nullptr), footprint(0)
+    {}
+};
+
 class Primitive
 {
 public:
-    virtual Point intersect(const Ray& ray) const = 0;
+    //returns coefficient of the closest intersection or Ray::NOWHERE
+    virtual double intersect(const Ray& ray) const = 0;
+    //same for every ray of the packet, rays are intersected one by one unless overridden
+    virtual void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const;
+    //fills the geometric part of the hit for the intersection found by intersect
+    virtual Hit hit(const Ray& ray, double coefficient) const = 0;
+    //same as intersect with the intersections not nearer than max_coefficient left out and any of them
+    //taken if any_hit is set. The part of the primitive hit is stored for hit, which is then not to look
+    //for it again. Primitives of a single part call intersect(ray) unless overridden
+    virtual double intersect(const Ray& ray, double max_coefficient, bool any_hit, uint32_t& part) const;
+    //fills the hit for the part found by intersect, hit(ray, coefficient) is called unless overridden
+    virtual Hit hit(const Ray& ray, double coefficient, uint32_t part) const;
     virtual double point(Point::Axis axis, Either either) const = 0;
-    virtual double angle_cos(const Ray& ray) const = 0;
-    virtual Orientation side(const Ray& ray) const = 0;
-    virtual Ray reflect(const Ray& ray) const = 0;
-    virtual Ray refract(const Ray& ray) const = 0;
-    virtual Color get_color(const Point& point) const = 0;
-    virtual double get_transparency() const = 0;
-    virtual double get_alpha() const = 0;
-    virtual double get_refraction() const = 0;
+    //side of the surface at the hit the ray begins on
+    virtual Orientation side(const Ray& ray, const Hit& hit) const = 0;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const = 0;
+    virtual Color get_color(const Hit& hit) const = 0;
+    //the surface may vary over the primitive, so it is given for the hit
+    virtual double get_transparency(const Hit& hit) const = 0;
+    virtual double get_alpha(const Hit& hit) const = 0;
+    virtual double get_refraction(const Hit& hit) const = 0;
+
+    Box bounds() const;
 
     virtual ~Primitive() = default;
 };
@@ -39,15 +77,15 @@ public:
         : surface(surface)
     {}
 
-    virtual double get_transparency() const override
+    virtual double get_transparency(const Hit&) const override
     {
         return surface.transparency;
     }
-    virtual double get_alpha() const override
+    virtual double get_alpha(const Hit&) const override
     {
         return surface.alpha;
     }
-    virtual double get_refraction() const override
+    virtual double get_refraction(const Hit&) const override
     {
         return surface.refraction;
     }
@@ -64,33 +102,35 @@ public:
         : Simple_surface_primitive(surface)
     {}
 
-    virtual Color get_color(const Point& point) const override
+    virtual Color get_color(const Hit&) const override
     {
         return Simple_surface_primitive::get_surface().color;
     }
 };
 
-//assuming points are enumerated clockwise
+//assuming points are enumerated clockwise and the polygon is convex
 template<size_t N>
 class Polygon
 {
 private:
     Orientation orientation;
     std::array<Point, N> points;
+    //the normal is computed once, as intersection is the innermost loop of tracing
+    Point normal;
 
 public:
     Polygon(const std::array<Point, N>& points, Orientation orientation = Orientation::UP)
         : orientation(orientation),
-          points(points)
+          points(points),
+          normal(cross(points[2] - points[0], points[1] - points[0]))
     {}
 
-    Point intersect(const Ray& ray) const;
+    double intersect(const Ray& ray) const;
+    void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const;
+    Hit hit(const Ray& ray, double coefficient) const;
     double point(Point::Axis axis, Either either) const;
-    bool in(const Point& point) const;
-    double angle_cos(const Ray& ray) const;
     Orientation side(const Ray& ray) const;
-    Ray reflect(const Ray& ray) const;
-    Ray refract(const Ray& ray, double refraction) const;
+    Ray refract(const Ray& ray, const Hit& hit, double refraction) const;
 
     Plane plane() const
     {
@@ -101,73 +141,81 @@ public:
     {
         return points[i];
     }
+    const std::array<Point, N>& get_points() const
+    {
+        return points;
+    }
     Orientation get_orientation() const
     {
         return orientation;
     }
 };
 
+//the polygon is tested as a fan of triangles sharing points[0]
 template<size_t N>
-Point Polygon<N>::intersect(const Ray& ray) const
+double Polygon<N>::intersect(const Ray& ray) const
 {
-    Plane polygon_plane = Plane(points[0], points[1], points[2]);
-    Point intersection = ray_tracing::intersect(ray, polygon_plane);
+    Ray_shear shear(ray);
 
-    if(intersection == Point::NOWHERE)
-        return Point::NOWHERE;
+    for(size_t i = 1; i + 1 < N; ++i)
+    {
+        double coefficient = triangle_coefficient(shear, points[0], points[i], points[i + 1]);
 
-    if(!in(intersection))
-        return Point::NOWHERE;
-    else
-        return intersection;
-}
+        if(coefficient != Ray::NOWHERE)
+            return coefficient;
+    }
 
-template<size_t N>
-double Polygon<N>::point(Point::Axis axis, Either either) const
-{
-    if(either == Either::LEFTEST)
-        return (*std::min_element(points.begin(), points.end(), Point::comparator(axis)))[axis];
-    else
-        return (*std::max_element(points.begin(), points.end(), Point::comparator(axis)))[axis];
+    return Ray::NOWHERE;
 }
 
 template<size_t N>
-bool Polygon<N>::in(const Point& point) const
+void Polygon<N>::intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const
 {
-    double angle_sum = 0;
-    for(size_t i = 0; i < N; ++i)
+    coefficients.fill(Ray::NOWHERE);
+
+    for(size_t i = 1; i + 1 < N; ++i)
     {
-        Point a = points[i] - point, b = points[(i + 1) % N] - point;
-        angle_sum += angle(a, b, cross(points[1] - points[0], points[2] - points[0]));
-    }
+        Ray_packet::Lanes triangle;
+        triangle_coefficients(packet, points[0], points[i], points[i + 1], triangle);
 
-    return !eq_zero(angle_sum);
+        for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+            if(coefficients[j] == Ray::NOWHERE)
+                coefficients[j] = triangle[j];
+    }
 }
 
 template<size_t N>
-double Polygon<N>::angle_cos(const Ray& ray) const
+Hit Polygon<N>::hit(const Ray& ray, double coefficient) const
 {
-    Plane polygon_plane = Plane(points[0], points[1], points[2]);
+    Hit result;
+
+    result.coefficient = coefficient;
+    result.point = ray.begin + ray.guiding() * coefficient;
+    result.normal = normal;
+    result.side = side(ray);
 
-    return ray_tracing::angle_cos(ray, polygon_plane);
+    return result;
 }
 
 template<size_t N>
-Orientation Polygon<N>::side(const Ray& ray) const
+double Polygon<N>::point(Point::Axis axis, Either either) const
 {
-    return ray_tracing::side(ray.begin, plane());
+    if(either == Either::LEFTEST)
+        return (*std::min_element(points.begin(), points.end(), Point::comparator(axis)))[axis];
+    else
+        return (*std::max_element(points.begin(), points.end(), Point::comparator(axis)))[axis];
 }
 
 template<size_t N>
-Ray Polygon<N>::reflect(const Ray& ray) const
+Orientation Polygon<N>::side(const Ray& ray) const
 {
-    return ray_tracing::reflect(ray, plane());
+    return dot(normal, ray.begin - points[0]) < 0 ? Orientation::DOWN : Orientation::UP;
 }
 
 template<size_t N>
-Ray Polygon<N>::refract(const Ray& ray, double refraction) const
+Ray Polygon<N>::refract(const Ray& ray, const Hit& hit, double refraction) const
 {
-    return ray_tracing::refract(ray, intersect(ray), plane().normal(), refraction);
+    return ray_tracing::refract(ray, hit.point, hit.normal, refraction);
 }
 
 class Triangle : public Monochrome_primitive, public Polygon<3ul>
@@ -182,12 +230,12 @@ public:
           Polygon(points, orientation)
     {}
 
-    virtual Point intersect(const Ray& ray) const override;
+    virtual double intersect(const Ray& ray) const override;
+    virtual void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const override;
+    virtual Hit hit(const Ray& ray, double coefficient) const override;
     virtual double point(Point::Axis axis, Either either) const override;
-    virtual double angle_cos(const Ray& ray) const override;
-    virtual Orientation side(const Ray& ray) const override;
-    virtual Ray reflect(const Ray& ray) const override;
-    virtual Ray refract(const Ray& ray) const override;
+    virtual Orientation side(const Ray& ray, const Hit& hit) const override;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const override;
 };
 
 class Base_quadrangle : public virtual Primitive, public Polygon<4ul>
@@ -198,12 +246,12 @@ public:
         : Polygon(points, orientation)
     {}
 
-    virtual Point intersect(const Ray& ray) const override;
+    virtual double intersect(const Ray& ray) const override;
+    virtual void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const override;
+    virtual Hit hit(const Ray& ray, double coefficient) const override;
     virtual double point(Point::Axis axis, Either either) const override;
-    virtual double angle_cos(const Ray& ray) const override;
-    virtual Orientation side(const Ray& ray) const override;
-    virtual Ray reflect(const Ray& ray) const override;
-    virtual Ray refract(const Ray& ray) const override;
+    virtual Orientation side(const Ray& ray, const Hit& hit) const override;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const override;
 };
 
 class Quadrangle : public Base_quadrangle, public Monochrome_primitive
@@ -219,7 +267,10 @@ public:
 
 //assuming points[0] is right_down, points[1] is left_down, points[2] is left_up
 class Base_parallelogramm : public Base_quadrangle
-{   
+{
+private:
+    Point left_down, up, right;
+
 public:
     Base_parallelogramm(const std::array<Point, 3ul>& points,
                         Orientation orientation = Orientation::UP)
@@ -227,8 +278,27 @@ public:
                                                     points[1],
                                                     points[2],
                                                     points[0] + points[2] - points[1]},
-                            orientation)
+                            orientation),
+          left_down(points[1]),
+          up(points[2] - points[1]),
+          right(points[0] - points[1])
     {}
+
+    virtual double intersect(const Ray& ray) const override;
+    virtual void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const override;
+
+    const Point& get_left_down() const
+    {
+        return left_down;
+    }
+    const Point& get_up() const
+    {
+        return up;
+    }
+    const Point& get_right() const
+    {
+        return right;
+    }
 };
 
 template<typename C>
@@ -258,15 +328,13 @@ public:
           Simple_surface_primitive(surface)
     {}
 
-    virtual Color get_color(const Point& point) const override
+    virtual Color get_color(const Hit& hit) const override
     {
-        std::array<double, 2> decomposition = projections(  Polygon::get_point(2) - Polygon::get_point(1),
-                                                            Polygon::get_point(0) - Polygon::get_point(1),
-                                                            point - Polygon::get_point(1));
+        const Texture& texture = Simple_surface_primitive::get_surface().color;
+        std::array<double, 2> uv = projections(get_up(), get_right(), hit.point - get_left_down());
 
-        Texture texture = Simple_surface_primitive::get_surface().color;
-        return texture  [decomposition[0] * texture.height()]
-                        [decomposition[1] * texture.width()];
+        return texture.sample(uv, hit.footprint * std::max(texture.height() / get_up().mod(),
+                                                               texture.width() / get_right().mod()));
     }
 };
 
@@ -281,17 +349,25 @@ public:
         : Monochrome_primitive(surface), center(center), r(r)
     {}
 
-    virtual Point intersect(const Ray& ray) const override;
+    virtual double intersect(const Ray& ray) const override;
+    virtual void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients) const override;
+    virtual Hit hit(const Ray& ray, double coefficient) const override;
     virtual double point(Point::Axis axis, Either either) const override;
-    virtual double angle_cos(const Ray& ray) const override;
-    virtual Orientation side(const Ray& ray) const override;
-    virtual Ray reflect(const Ray& ray) const override;
-    virtual Ray refract(const Ray& ray) const override;
+    virtual Orientation side(const Ray& ray, const Hit& hit) const override;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const override;
 
     bool in(const Point& point) const
     {
         return (center - point).mod() < r;
     }
+    const Point& get_center() const
+    {
+        return center;
+    }
+    double get_r() const
+    {
+        return r;
+    }
     Point normal(const Point& point) const
     {
         return point - center;
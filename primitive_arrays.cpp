@@ -0,0 +1,271 @@
+#include <algorithm>
+
+#include "primitive_arrays.h"
+#include "geometry.h"
+#include "packet.h"
+
+ray_tracing::Primitive_arrays::Primitive_arrays(const std::vector<std::shared_ptr<Primitive>>& primitives)
+    : primitives(primitives)
+{
+    std::array<std::vector<Source>, TYPES_NUM> typed_sources;
+
+    auto add = [&typed_sources](Primitive_type type, uint32_t primitive, uint32_t part)
+               {
+                   typed_sources[size_t(type)].push_back(Source{primitive, part});
+               };
+
+    for(uint32_t i = 0; i < primitives.size(); ++i)
+    {
+        const Primitive* primitive = primitives[i].get();
+        meshes.push_back(dynamic_cast<const Triangle_mesh*>(primitive));
+
+        if(const Base_parallelogramm* parallelogramm = dynamic_cast<const Base_parallelogramm*>(primitive))
+        {
+            add(Primitive_type::PARALLELOGRAMM, i, 0);
+            parallelogramms.push_back(Quadrangle_record{parallelogramm->get_points()});
+        }
+        else if(const Base_quadrangle* quadrangle = dynamic_cast<const Base_quadrangle*>(primitive))
+        {
+            add(Primitive_type::QUADRANGLE, i, 0);
+            quadrangles.push_back(Quadrangle_record{quadrangle->get_points()});
+        }
+        else if(const Triangle* triangle = dynamic_cast<const Triangle*>(primitive))
+        {
+            add(Primitive_type::TRIANGLE, i, 0);
+            triangles.push_back(Triangle_record{triangle->get_point(0),
+                                                triangle->get_point(1),
+                                                triangle->get_point(2)});
+        }
+        else if(const Sphere* sphere = dynamic_cast<const Sphere*>(primitive))
+        {
+            add(Primitive_type::SPHERE, i, 0);
+            spheres.push_back(Sphere_record{sphere->get_center(), sphere->get_r()});
+        }
+        else if(meshes.back())
+            for(uint32_t j = 0; j < meshes.back()->triangles_num(); ++j)
+                add(Primitive_type::MESH_TRIANGLE, i, j);
+        else
+            add(Primitive_type::OTHER, i, 0);
+    }
+
+    offsets[0] = 0;
+
+    for(size_t t = 0; t < TYPES_NUM; ++t)
+    {
+        sources.insert(sources.end(), typed_sources[t].begin(), typed_sources[t].end());
+        offsets[t + 1] = sources.size();
+    }
+}
+
+ray_tracing::Box ray_tracing::Primitive_arrays::bounds(uint32_t element) const
+{
+    const Source& source = sources[element];
+
+    return type(element) == Primitive_type::MESH_TRIANGLE ? meshes[source.primitive]->bounds(source.part) :
+                                                           primitives[source.primitive]->bounds();
+}
+
+bool ray_tracing::Primitive_arrays::matches(const Primitive_arrays& arrays) const
+{
+    auto same = [](const Source& a, const Source& b)
+                {
+                    return a.primitive == b.primitive && a.part == b.part;
+                };
+
+    return offsets == arrays.offsets &&
+           std::equal(sources.begin(), sources.end(), arrays.sources.begin(), arrays.sources.end(), same);
+}
+
+template<ray_tracing::Primitive_type T>
+double ray_tracing::Primitive_arrays::intersect(const Ray& ray,
+                                                const Ray_shear& shear,
+                                                uint32_t element,
+                                                double limit,
+                                                bool any_hit,
+                                                uint32_t& part) const
+{
+    uint32_t index = element - offsets[size_t(T)];
+
+    switch(T)
+    {
+    case Primitive_type::TRIANGLE:
+        return triangle_coefficient(shear, triangles[index].a, triangles[index].b, triangles[index].c);
+    case Primitive_type::QUADRANGLE:
+    {
+        //the fan of Polygon::intersect
+        const std::array<Point, 4>& points = quadrangles[index].points;
+        double coefficient = triangle_coefficient(shear, points[0], points[1], points[2]);
+
+        return coefficient != Ray::NOWHERE ? coefficient : triangle_coefficient(shear, points[0], points[2], points[3]);
+    }
+    case Primitive_type::PARALLELOGRAMM:
+        return parallelogramm_coefficient(shear, parallelogramms[index].points);
+    case Primitive_type::SPHERE:
+        return sphere_coefficient(ray, spheres[index].center, spheres[index].r);
+    case Primitive_type::MESH_TRIANGLE:
+        return meshes[sources[element].primitive]->intersect(shear, sources[element].part);
+    default:
+        return primitives[sources[element].primitive]->intersect(ray, limit, any_hit, part);
+    }
+}
+
+template<ray_tracing::Primitive_type T>
+bool ray_tracing::Primitive_arrays::intersect_run(const Ray& ray,
+                                                  const Ray_shear& shear,
+                                                  const uint32_t* begin, const uint32_t* end,
+                                                  bool any_hit,
+                                                  double& limit,
+                                                  Intersection& closest) const
+{
+    bool found = false;
+
+    for(const uint32_t* it = begin; it != end; ++it)
+    {
+        uint32_t part = 0;
+        double coefficient = intersect<T>(ray, shear, *it, limit, any_hit, part);
+
+        if(coefficient != Ray::NOWHERE && coefficient < limit)
+        {
+            limit = coefficient;
+            closest = Intersection{coefficient, *it, part};
+            found = true;
+
+            if(any_hit)
+                break;
+        }
+    }
+
+    return found;
+}
+
+bool ray_tracing::Primitive_arrays::intersect(const Ray& ray,
+                                              const uint32_t* begin, const uint32_t* end,
+                                              bool any_hit,
+                                              double& limit,
+                                              Intersection& closest) const
+{
+    bool found = false;
+    Ray_shear shear(ray);
+
+    while(begin != end && !(found && any_hit))
+    {
+        Primitive_type run_type = type(*begin);
+        const uint32_t* run_end = begin;
+
+        while(run_end != end && *run_end < offsets[size_t(run_type) + 1])
+            ++run_end;
+
+        switch(run_type)
+        {
+        case Primitive_type::TRIANGLE:
+            found |= intersect_run<Primitive_type::TRIANGLE>(ray, shear, begin, run_end, any_hit, limit, closest);
+            break;
+        case Primitive_type::QUADRANGLE:
+            found |= intersect_run<Primitive_type::QUADRANGLE>(ray, shear, begin, run_end, any_hit, limit, closest);
+            break;
+        case Primitive_type::PARALLELOGRAMM:
+            found |= intersect_run<Primitive_type::PARALLELOGRAMM>(ray, shear, begin, run_end, any_hit, limit, closest);
+            break;
+        case Primitive_type::SPHERE:
+            found |= intersect_run<Primitive_type::SPHERE>(ray, shear, begin, run_end, any_hit, limit, closest);
+            break;
+        case Primitive_type::MESH_TRIANGLE:
+            found |= intersect_run<Primitive_type::MESH_TRIANGLE>(ray, shear, begin, run_end, any_hit, limit, closest);
+            break;
+        default:
+            found |= intersect_run<Primitive_type::OTHER>(ray, shear, begin, run_end, any_hit, limit, closest);
+        }
+
+        begin = run_end;
+    }
+
+    return found;
+}
+
+void ray_tracing::Primitive_arrays::intersect(const Ray_packet& packet,
+                                              uint32_t element,
+                                              Ray_packet::Lanes& coefficients) const
+{
+    Primitive_type element_type = type(element);
+    uint32_t index = element - offsets[size_t(element_type)];
+
+    switch(element_type)
+    {
+    case Primitive_type::TRIANGLE:
+        triangle_coefficients(packet, triangles[index].a, triangles[index].b, triangles[index].c, coefficients);
+        break;
+    case Primitive_type::QUADRANGLE:
+    {
+        const std::array<Point, 4>& points = quadrangles[index].points;
+        Ray_packet::Lanes second;
+
+        triangle_coefficients(packet, points[0], points[1], points[2], coefficients);
+        triangle_coefficients(packet, points[0], points[2], points[3], second);
+
+        for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+            if(coefficients[j] == Ray::NOWHERE)
+                coefficients[j] = second[j];
+
+        break;
+    }
+    case Primitive_type::PARALLELOGRAMM:
+        parallelogramm_coefficients(packet, parallelogramms[index].points, coefficients);
+        break;
+    case Primitive_type::SPHERE:
+        sphere_coefficients(packet, spheres[index].center, spheres[index].r, coefficients);
+        break;
+    case Primitive_type::MESH_TRIANGLE:
+        meshes[sources[element].primitive]->intersect(packet, coefficients, sources[element].part);
+        break;
+    default:
+        primitives[sources[element].primitive]->intersect(packet, coefficients);
+    }
+}
+
+void ray_tracing::Primitive_arrays::intersect(const Ray_packet& packet,
+                                              const uint32_t* begin, const uint32_t* end,
+                                              Ray_packet::Lanes& limit,
+                                              std::array<Intersection, Ray_packet::SIZE>& closest) const
+{
+    for(const uint32_t* it = begin; it != end; ++it)
+    {
+        //OTHER elements are intersected ray by ray, so that they find their parts within the limits
+        if(type(*it) == Primitive_type::OTHER)
+        {
+            for(size_t j = 0; j < packet.size; ++j)
+                intersect_run<Primitive_type::OTHER>(packet.rays[j],
+                                                     packet.shears[j],
+                                                     it, it + 1,
+                                                     false,
+                                                     limit[j],
+                                                     closest[j]);
+
+            continue;
+        }
+
+        Ray_packet::Lanes coefficients;
+        intersect(packet, *it, coefficients);
+
+        for(size_t j = 0; j < Ray_packet::SIZE; ++j)
+            if(coefficients[j] != Ray::NOWHERE && coefficients[j] < limit[j])
+            {
+                limit[j] = coefficients[j];
+                closest[j] = Intersection{coefficients[j], *it, 0};
+            }
+    }
+}
+
+//the part of a mesh triangle is the triangle, the one of an OTHER element is found by its intersection
+ray_tracing::Hit ray_tracing::Primitive_arrays::hit(const Intersection& intersection, const Ray& ray) const
+{
+    uint32_t element = intersection.element;
+    const Source& source = sources[element];
+
+    Hit result = type(element) == Primitive_type::MESH_TRIANGLE ?
+                     meshes[source.primitive]->hit(ray, intersection.coefficient, source.part) :
+                     primitives[source.primitive]->hit(ray, intersection.coefficient, intersection.part);
+    result.primitive = primitives[source.primitive].get();
+    result.primitive_id = element;
+
+    return result;
+}
@@ -0,0 +1,128 @@
+#ifndef PRIMITIVE_ARRAYS_H
+#define PRIMITIVE_ARRAYS_H
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include "primitive.h"
+#include "triangle_mesh.h"
+#include "geometry.h"
+#include "packet.h"
+
+namespace ray_tracing
+{
+
+//closest intersection found by a traversal. The part is the one an OTHER primitive has found to be hit,
+//it is given back to the primitive so that the hit is filled without intersecting it again
+struct Intersection
+{
+    double coefficient;
+    uint32_t element, part;
+};
+
+//OTHER primitives are tested through their virtual methods
+enum class Primitive_type : uint32_t {TRIANGLE, QUADRANGLE, PARALLELOGRAMM, SPHERE, MESH_TRIANGLE, OTHER};
+
+//what acceleration structures are built of: the primitives split into elements of a few types.
+//Each type keeps the data of its intersection test in an array of its own, and elements are
+//numbered type by type, so the type of an element follows from its index. Leaves with sorted
+//indices are runs of a single type, which are tested by inlined code instead of virtual calls
+class Primitive_arrays
+{
+public:
+    static const size_t TYPES_NUM = 6;
+
+private:
+    //vertices are kept as they are, so that triangles sharing them are intersected watertight
+    struct Triangle_record
+    {
+        Point a, b, c;
+    };
+    //vertices in order, a quadrangle is a fan of two triangles sharing the first one
+    struct Quadrangle_record
+    {
+        std::array<Point, 4> points;
+    };
+    struct Sphere_record
+    {
+        Point center;
+        double r;
+    };
+    //primitive an element comes from and its part, the triangle of a mesh
+    struct Source
+    {
+        uint32_t primitive, part;
+    };
+
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    //meshes among the primitives by the same indices, nullptr for the other primitives
+    std::vector<const Triangle_mesh*> meshes;
+    std::vector<Source> sources;
+    //elements of type t are [offsets[t], offsets[t + 1])
+    std::array<uint32_t, TYPES_NUM + 1> offsets;
+    std::vector<Triangle_record> triangles;
+    std::vector<Quadrangle_record> quadrangles, parallelogramms;
+    std::vector<Sphere_record> spheres;
+
+    //the shear is the one of the ray, computed once per leaf. Limit, any_hit and part are used by OTHER elements only
+    template<Primitive_type T>
+    double intersect(const Ray& ray,
+                     const Ray_shear& shear,
+                     uint32_t element,
+                     double limit,
+                     bool any_hit,
+                     uint32_t& part) const;
+    template<Primitive_type T>
+    bool intersect_run(const Ray& ray,
+                       const Ray_shear& shear,
+                       const uint32_t* begin, const uint32_t* end,
+                       bool any_hit,
+                       double& limit,
+                       Intersection& closest) const;
+    void intersect(const Ray_packet& packet, uint32_t element, Ray_packet::Lanes& coefficients) const;
+
+public:
+    Primitive_arrays(const std::vector<std::shared_ptr<Primitive>>& primitives);
+
+    size_t size() const
+    {
+        return sources.size();
+    }
+    size_t primitives_num() const
+    {
+        return primitives.size();
+    }
+    Primitive_type type(uint32_t element) const
+    {
+        size_t t = 0;
+        while(element >= offsets[t + 1])
+            ++t;
+
+        return Primitive_type(t);
+    }
+    Box bounds(uint32_t element) const;
+    //whether the elements are numbered the same way, so structures built of one array fit the other
+    bool matches(const Primitive_arrays& arrays) const;
+
+    //updates closest with the closest element of [begin, end) intersected nearer than limit, and limit
+    //with its coefficient. Stops at the first intersection if any_hit is set. The indices are expected
+    //to be sorted. Returns whether an intersection was found
+    bool intersect(const Ray& ray,
+                   const uint32_t* begin, const uint32_t* end,
+                   bool any_hit,
+                   double& limit,
+                   Intersection& closest) const;
+    //same for every ray of the packet
+    void intersect(const Ray_packet& packet,
+                   const uint32_t* begin, const uint32_t* end,
+                   Ray_packet::Lanes& limit,
+                   std::array<Intersection, Ray_packet::SIZE>& closest) const;
+    //the hit is filled by the primitive the element comes from
+    Hit hit(const Intersection& intersection, const Ray& ray) const;
+};
+
+}
+
+#endif // PRIMITIVE_ARRAYS_H
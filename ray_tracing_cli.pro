@@ -0,0 +1,68 @@
+#-------------------------------------------------
+#
+# Headless renderer, writes pictures to files and doesn't need Qt
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = ray_tracing_cli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt app_bundle
+
+SOURCES += main_cli.cpp \
+    image_writer.cpp \
+    geometry.cpp \
+    primitive.cpp \
+    tracer.cpp \
+    picture_buffer.cpp \
+    render_statistics.cpp \
+    picture.cpp \
+    texture.cpp \
+    texture_loader.cpp \
+    mapped_file.cpp \
+    scene_cache.cpp \
+    triangle_mesh.cpp \
+    mesh_loader.cpp \
+    primitive_arrays.cpp \
+    instance.cpp \
+    light.cpp \
+    kd_tree.cpp \
+    bvh.cpp \
+    acceleration_structure.cpp \
+    packet.cpp \
+    thread_pool.cpp \
+    parser.cpp
+
+HEADERS  += \
+    image_writer.h \
+    geometry.h \
+    primitive.h \
+    tracer.h \
+    picture_buffer.h \
+    render_control.h \
+    render_statistics.h \
+    picture.h \
+    image.h \
+    texture.h \
+    texture_loader.h \
+    mapped_file.h \
+    scene_cache.h \
+    cache_io.h \
+    triangle_mesh.h \
+    mesh_loader.h \
+    primitive_arrays.h \
+    instance.h \
+    light.h \
+    kd_tree.h \
+    bvh.h \
+    acceleration_structure.h \
+    packet.h \
+    thread_pool.h \
+    parser.h \
+    template_utils.h
+
+#errno is never read, without it sqrt needs no branch and the packet kernels are vectorized
+QMAKE_CXXFLAGS += -std=c++17 -pthread -fno-math-errno
+LIBS += -pthread
@@ -0,0 +1,63 @@
+#ifndef RENDER_CONTROL_H
+#define RENDER_CONTROL_H
+
+#include <atomic>
+#include <chrono>
+
+namespace ray_tracing
+{
+
+//stops a picture being produced: when it is cancelled from another thread or at a deadline.
+//The tiles being rendered when it stops are left within a packet or a row of pixels,
+//the ones not started yet are skipped
+class Render_control
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    std::atomic<bool> cancelled;
+    Clock::time_point deadline;
+    bool adaptive;
+
+public:
+    Render_control()
+        : cancelled(false), deadline(Clock::time_point::max()), adaptive(false)
+    {}
+
+    void cancel()
+    {
+        cancelled = true;
+    }
+    //clears the cancellation, so that the control can be used for the next picture
+    void reset()
+    {
+        cancelled = false;
+    }
+    //the picture is rendered at full quality until the deadline
+    void set_deadline(Clock::time_point deadline_)
+    {
+        deadline = deadline_;
+        adaptive = false;
+    }
+    //the picture is rendered at increasing quality until the budget from now runs out,
+    //so that the best one achieved within it is produced
+    void set_budget(Clock::duration budget)
+    {
+        deadline = Clock::now() + budget;
+        adaptive = true;
+    }
+
+    bool is_adaptive() const
+    {
+        return adaptive;
+    }
+    bool is_stopped() const
+    {
+        return cancelled || Clock::now() >= deadline;
+    }
+};
+
+}
+
+#endif // RENDER_CONTROL_H
@@ -0,0 +1,92 @@
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "render_statistics.h"
+
+ray_tracing::Render_statistics::Render_statistics()
+    : primary_rays(0), secondary_rays(0), shadow_rays(0),
+      traversals(0), nodes_visited(0), leaves_visited(0),
+      tests(),
+      leaf_sizes(),
+      tiles(0), pixels(0), supersampled_pixels(0),
+      phase_times(),
+      wall_time(0),
+      threads_num(0)
+{}
+
+ray_tracing::Render_statistics& ray_tracing::Render_statistics::operator+=(const Render_statistics& statistics)
+{
+    primary_rays += statistics.primary_rays;
+    secondary_rays += statistics.secondary_rays;
+    shadow_rays += statistics.shadow_rays;
+    traversals += statistics.traversals;
+    nodes_visited += statistics.nodes_visited;
+    leaves_visited += statistics.leaves_visited;
+
+    for(size_t i = 0; i < tests.size(); ++i)
+        tests[i] += statistics.tests[i];
+    for(size_t i = 0; i < leaf_sizes.size(); ++i)
+        leaf_sizes[i] += statistics.leaf_sizes[i];
+
+    tiles += statistics.tiles;
+    pixels += statistics.pixels;
+    supersampled_pixels += statistics.supersampled_pixels;
+
+    for(size_t i = 0; i < phase_times.size(); ++i)
+        phase_times[i] += statistics.phase_times[i];
+
+    wall_time += statistics.wall_time;
+    threads_num = std::max(threads_num, statistics.threads_num);
+
+    return *this;
+}
+
+void ray_tracing::write_json(std::ostream& stream, const Render_statistics& statistics, size_t indent)
+{
+    static const char* const TYPE_NAMES[] = {"triangle",
+                                             "quadrangle",
+                                             "parallelogramm",
+                                             "sphere",
+                                             "mesh_triangle",
+                                             "other"};
+    static_assert(sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]) == Primitive_arrays::TYPES_NUM,
+                  "every primitive type is to be named");
+
+    std::string outer(indent, ' '), inner(indent + 4, ' ');
+
+    stream << "{" << std::endl
+           << inner << "\"wall_time\": " << statistics.wall_time << "," << std::endl
+           << inner << "\"threads\": " << statistics.threads_num << "," << std::endl
+           << inner << "\"phases\": {\"build\": " << statistics.phase_times[Render_statistics::BUILD]
+                    << ", \"trace\": " << statistics.phase_times[Render_statistics::TRACE]
+                    << ", \"aa_detection\": " << statistics.phase_times[Render_statistics::AA_DETECTION]
+                    << ", \"aa_resolve\": " << statistics.phase_times[Render_statistics::AA_RESOLVE] << "},"
+                    << std::endl
+           << inner << "\"rays\": {\"primary\": " << statistics.primary_rays
+                    << ", \"secondary\": " << statistics.secondary_rays
+                    << ", \"shadow\": " << statistics.shadow_rays << "}," << std::endl
+           << inner << "\"traversals\": " << statistics.traversals << "," << std::endl
+           << inner << "\"nodes_visited\": " << statistics.nodes_visited << "," << std::endl
+           << inner << "\"leaves_visited\": " << statistics.leaves_visited << "," << std::endl
+           << inner << "\"tests\": {";
+
+    for(size_t i = 0; i < statistics.tests.size(); ++i)
+        stream << (i == 0 ? "" : ", ") << "\"" << TYPE_NAMES[i] << "\": " << statistics.tests[i];
+
+    stream << "}," << std::endl
+           << inner << "\"leaf_sizes\": [";
+
+    for(size_t i = 0; i < statistics.leaf_sizes.size(); ++i)
+        stream << (i == 0 ? "" : ", ") << statistics.leaf_sizes[i];
+
+    double supersampled_fraction = statistics.pixels == 0 ? 0 :
+                                                            double(statistics.supersampled_pixels) / statistics.pixels;
+
+    stream << "]," << std::endl
+           << inner << "\"tiles\": " << statistics.tiles << "," << std::endl
+           << inner << "\"pixels\": " << statistics.pixels << "," << std::endl
+           << inner << "\"supersampled_pixels\": " << statistics.supersampled_pixels << "," << std::endl
+           << inner << "\"supersampled_fraction\": " << supersampled_fraction << std::endl
+           << outer << "}";
+}
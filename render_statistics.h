@@ -0,0 +1,65 @@
+#ifndef RENDER_STATISTICS_H
+#define RENDER_STATISTICS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "primitive_arrays.h"
+
+namespace ray_tracing
+{
+
+//counters of the pictures produced by a tracer which collects them. Every thread counts into
+//counters of its own, aligned to a cache line, and they are summed when the picture is complete
+struct alignas(64) Render_statistics
+{
+    //visited leaves by their sizes: 1, 2 - 3, 4 - 7 and so on, the last bucket takes the rest
+    static const size_t LEAF_SIZE_BUCKETS = 8;
+
+    //build is the wall time spent on the changes of the scene, the others are summed over the threads.
+    //AA_DETECTION is finding the pixels to supersample, AA_RESOLVE is supersampling them
+    enum Phase {BUILD, TRACE, AA_DETECTION, AA_RESOLVE, PHASES_NUM};
+
+    size_t primary_rays, secondary_rays, shadow_rays;
+    //traversals of the acceleration structures, the ones of the groups placed by instances included
+    size_t traversals, nodes_visited, leaves_visited;
+    //elements in the leaves visited, by their types
+    std::array<size_t, Primitive_arrays::TYPES_NUM> tests;
+    std::array<size_t, LEAF_SIZE_BUCKETS> leaf_sizes;
+    size_t tiles, pixels, supersampled_pixels;
+    std::array<double, PHASES_NUM> phase_times;
+    double wall_time;
+    //threads which have rendered tiles, the one producing the picture takes part along with the pool
+    size_t threads_num;
+
+    Render_statistics();
+
+    Render_statistics& operator+=(const Render_statistics& statistics);
+
+    //counts the elements of a leaf visited by the rays
+    void count_leaf(const Primitive_arrays& elements, const uint32_t* begin, const uint32_t* end, size_t rays = 1)
+    {
+        ++leaves_visited;
+
+        size_t bucket = 0;
+        while(bucket + 1 < LEAF_SIZE_BUCKETS && size_t(end - begin) >> (bucket + 1) != 0)
+            ++bucket;
+        ++leaf_sizes[bucket];
+
+        for(const uint32_t* it = begin; it != end; ++it)
+            tests[size_t(elements.type(*it))] += rays;
+    }
+};
+
+//counters of the calling thread, nullptr unless it is rendering a picture whose statistics are collected.
+//Defined here with a constant initializer, so that reading it is a plain thread local load
+inline thread_local Render_statistics* thread_statistics = nullptr;
+
+//writes the statistics as a JSON object, nested lines are indented by indent spaces
+void write_json(std::ostream& stream, const Render_statistics& statistics, size_t indent = 0);
+
+}
+
+#endif // RENDER_STATISTICS_H
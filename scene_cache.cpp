@@ -0,0 +1,402 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "scene_cache.h"
+#include "mapped_file.h"
+#include "cache_io.h"
+
+const char ray_tracing::Scene_cache::MAGIC[4] = {'R', 'T', 'S', 'C'};
+const uint32_t ray_tracing::Scene_cache::VERSION;
+
+uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+    return x ^ (x >> 31);
+}
+
+//returns false if the file can't be read
+bool hash_file(const std::string& file, uint64_t& result)
+{
+    ray_tracing::Mapped_file mapped(file);
+
+    if(!mapped.is_open())
+        return false;
+
+    result = ray_tracing::Scene_cache::hash(mapped.data(), mapped.size());
+
+    return true;
+}
+
+//the text is hashed by 8 byte words
+uint64_t ray_tracing::Scene_cache::hash(const char* data, size_t size, uint64_t seed)
+{
+    static const uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ull;
+
+    uint64_t result = seed ^ (size * MULTIPLIER);
+    size_t i = 0;
+
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+
+        result ^= mix(word);
+        result = (result << 27 | result >> 37) * MULTIPLIER;
+    }
+
+    uint64_t tail = 0;
+    if(size > i)
+        memcpy(&tail, data + i, size - i);
+
+    return mix(result ^ mix(tail));
+}
+
+bool ray_tracing::Cache_writer::save(const std::string& file) const
+{
+    std::string temporary = file + ".tmp";
+
+    {
+        std::ofstream out(temporary, std::ios_base::out | std::ios_base::binary);
+        out.write(data.data(), data.size());
+
+        if(!out)
+            return false;
+    }
+
+    return std::rename(temporary.c_str(), file.c_str()) == 0;
+}
+
+void ray_tracing::Scene_cache::write(Cache_writer& writer, const Mesh_buffers& buffers)
+{
+    writer.write(buffers.source);
+
+    for(const std::vector<double>& coordinates : buffers.positions)
+        writer.write(coordinates);
+    for(const std::vector<float>& coordinates : buffers.normals)
+        writer.write(coordinates);
+    for(const std::vector<float>& coordinates : buffers.uvs)
+        writer.write(coordinates);
+
+    writer.write(buffers.indices);
+}
+
+std::shared_ptr<const ray_tracing::Mesh_buffers> ray_tracing::Scene_cache::read(Cache_reader& reader)
+{
+    std::shared_ptr<Mesh_buffers> result = std::make_shared<Mesh_buffers>();
+
+    reader.read(result->source);
+
+    for(std::vector<double>& coordinates : result->positions)
+        reader.read(coordinates);
+    for(std::vector<float>& coordinates : result->normals)
+        reader.read(coordinates);
+    for(std::vector<float>& coordinates : result->uvs)
+        reader.read(coordinates);
+
+    reader.read(result->indices);
+
+    size_t vertices_num = result->vertices_num();
+    bool consistent = result->indices.size() % 3 == 0 && !result->indices.empty();
+
+    for(const std::vector<double>& coordinates : result->positions)
+        consistent &= coordinates.size() == vertices_num;
+    for(const std::vector<float>& coordinates : result->normals)
+        consistent &= coordinates.size() == (result->has_normals() ? vertices_num : 0);
+    for(const std::vector<float>& coordinates : result->uvs)
+        consistent &= coordinates.size() == (result->has_uvs() ? vertices_num : 0);
+    for(uint32_t index : result->indices)
+        consistent &= index < vertices_num;
+
+    if(!consistent)
+        throw std::runtime_error("corrupted mesh");
+
+    return result;
+}
+
+bool ray_tracing::Scene_cache::load(const std::string& file, uint64_t key, Scene& scene, Texture_cache& textures)
+{
+    scene.cache_file = file;
+    scene.cache_key = key;
+
+    Mapped_file mapped(file);
+
+    if(!mapped.is_open())
+        return false;
+
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    std::unique_ptr<Acceleration_structure> tree;
+
+    try
+    {
+        Cache_reader reader(mapped.data(), mapped.data() + mapped.size());
+
+        std::array<char, 4> magic;
+        uint32_t version;
+        uint64_t saved_key, checksum;
+        Acceleration acceleration;
+
+        reader.read(magic);
+        reader.read(version);
+        reader.read(saved_key);
+        reader.read(acceleration);
+        reader.read(checksum);
+
+        if(!std::equal(magic.begin(), magic.end(), MAGIC) ||
+           version != VERSION ||
+           saved_key != key ||
+           acceleration != scene.acceleration ||
+           checksum != hash(reader.position(), reader.remaining()))
+            return false;
+
+        uint64_t textures_num;
+        reader.read(textures_num);
+
+        std::vector<Texture> texture_table;
+        for(uint64_t i = 0; i < textures_num; ++i)
+        {
+            std::string path;
+            reader.read(path);
+
+            texture_table.push_back(textures.load(path));
+        }
+
+        uint64_t meshes_num;
+        reader.read(meshes_num);
+
+        std::vector<std::shared_ptr<const Mesh_buffers>> mesh_table;
+        for(uint64_t i = 0; i < meshes_num; ++i)
+        {
+            uint64_t saved_hash, file_hash;
+            reader.read(saved_hash);
+            mesh_table.push_back(read(reader));
+
+            if(!hash_file(mesh_table.back()->source, file_hash) || file_hash != saved_hash)
+                return false;
+        }
+
+        std::vector<Record> records;
+        reader.read(records);
+        primitives.reserve(records.size());
+
+        for(const Record& record : records)
+        {
+            std::array<Point, 4> points;
+            for(size_t i = 0; i < points.size(); ++i)
+                points[i].coordinates = record.points[i];
+
+            Surface<Color> surface(record.color, record.alpha, record.transparency, record.refraction);
+            Surface<Texture> textured(Texture(), record.alpha, record.transparency, record.refraction);
+
+            if(record.type == Type::TEXTURED_PARALLELOGRAMM || record.type == Type::TEXTURED_MESH)
+            {
+                if(record.texture >= texture_table.size())
+                    return false;
+
+                textured.color = texture_table[record.texture];
+                textured.color.set_sampler(record.sampler);
+            }
+
+            if((record.type == Type::MESH || record.type == Type::TEXTURED_MESH) && record.mesh >= mesh_table.size())
+                return false;
+
+            switch(record.type)
+            {
+            case Type::TRIANGLE:
+                primitives.push_back(std::make_shared<Triangle>(std::array<Point, 3>{points[0], points[1], points[2]},
+                                                                surface,
+                                                                record.orientation));
+                break;
+            case Type::QUADRANGLE:
+                primitives.push_back(std::make_shared<Quadrangle>(points, surface, record.orientation));
+                break;
+            case Type::PARALLELOGRAMM:
+                primitives.push_back(std::make_shared<Parallelogramm<Color>>(
+                                         std::array<Point, 3>{points[0], points[1], points[2]},
+                                         surface,
+                                         record.orientation));
+                break;
+            case Type::TEXTURED_PARALLELOGRAMM:
+                primitives.push_back(std::make_shared<Parallelogramm<Texture>>(
+                                         std::array<Point, 3>{points[0], points[1], points[2]},
+                                         textured,
+                                         record.orientation));
+                break;
+            case Type::SPHERE:
+                primitives.push_back(std::make_shared<Sphere>(points[0], record.r, surface));
+                break;
+            case Type::MESH:
+                primitives.push_back(std::make_shared<Triangle_mesh>(mesh_table[record.mesh], surface));
+                break;
+            case Type::TEXTURED_MESH:
+                primitives.push_back(std::make_shared<Triangle_mesh>(mesh_table[record.mesh], textured));
+                break;
+            default:
+                return false;
+            }
+        }
+
+        tree = load_acceleration_structure(acceleration, primitives, reader);
+    }
+    catch(const std::runtime_error&)
+    {
+        return false;
+    }
+
+    scene.primitives = std::move(primitives);
+    scene.tree = std::move(tree);
+    scene.cache_file.clear();
+
+    return true;
+}
+
+bool ray_tracing::Scene_cache::save(const std::string& file,
+                                    uint64_t key,
+                                    const Scene& scene,
+                                    const Acceleration_structure& tree)
+{
+    std::map<std::string, uint32_t> texture_indices;
+    std::vector<std::string> texture_table;
+    std::map<const Mesh_buffers*, uint32_t> mesh_indices;
+    std::vector<const Mesh_buffers*> mesh_table;
+    std::vector<Record> records(scene.primitives.size());
+
+    //records are zeroed, so that padding bytes are stored deterministically
+    memset(static_cast<void*>(records.data()), 0, records.size() * sizeof(Record));
+
+    for(size_t i = 0; i < scene.primitives.size(); ++i)
+    {
+        const Primitive* primitive = scene.primitives[i].get();
+        Record& record = records[i];
+
+        auto store_polygon = [&record](const auto& polygon, size_t points_num)
+                             {
+                                 for(size_t j = 0; j < points_num; ++j)
+                                     record.points[j] = polygon.get_point(j).coordinates;
+
+                                 record.orientation = polygon.get_orientation();
+                             };
+        auto store_surface = [&record](const auto& surface)
+                             {
+                                 record.alpha = surface.alpha;
+                                 record.transparency = surface.transparency;
+                                 record.refraction = surface.refraction;
+                             };
+        //returns false if the texture can't be loaded again
+        auto store_texture = [&record, &texture_indices, &texture_table](const Texture& texture)
+                             {
+                                 if(texture.get_source().empty())
+                                     return false;
+
+                                 if(texture_indices.find(texture.get_source()) == texture_indices.end())
+                                 {
+                                     texture_indices[texture.get_source()] = texture_table.size();
+                                     texture_table.push_back(texture.get_source());
+                                 }
+
+                                 record.texture = texture_indices[texture.get_source()];
+                                 record.sampler = texture.get_sampler();
+
+                                 return true;
+                             };
+
+        if(const Triangle* triangle = dynamic_cast<const Triangle*>(primitive))
+        {
+            record.type = Type::TRIANGLE;
+            store_polygon(*triangle, 3);
+            store_surface(triangle->get_surface());
+            record.color = triangle->get_surface().color;
+        }
+        else if(const Quadrangle* quadrangle = dynamic_cast<const Quadrangle*>(primitive))
+        {
+            record.type = Type::QUADRANGLE;
+            store_polygon(*quadrangle, 4);
+            store_surface(quadrangle->get_surface());
+            record.color = quadrangle->get_surface().color;
+        }
+        else if(const Parallelogramm<Color>* parallelogramm = dynamic_cast<const Parallelogramm<Color>*>(primitive))
+        {
+            record.type = Type::PARALLELOGRAMM;
+            store_polygon(*parallelogramm, 3);
+            store_surface(parallelogramm->get_surface());
+            record.color = parallelogramm->get_surface().color;
+        }
+        else if(const Parallelogramm<Texture>* textured = dynamic_cast<const Parallelogramm<Texture>*>(primitive))
+        {
+            if(!store_texture(textured->get_surface().color))
+                return false;
+
+            record.type = Type::TEXTURED_PARALLELOGRAMM;
+            store_polygon(*textured, 3);
+            store_surface(textured->get_surface());
+        }
+        else if(const Triangle_mesh* mesh = dynamic_cast<const Triangle_mesh*>(primitive))
+        {
+            if(mesh->is_textured() && !store_texture(mesh->get_texture()))
+                return false;
+
+            const Mesh_buffers* buffers = mesh->get_buffers().get();
+
+            if(mesh_indices.find(buffers) == mesh_indices.end())
+            {
+                mesh_indices[buffers] = mesh_table.size();
+                mesh_table.push_back(buffers);
+            }
+
+            record.type = mesh->is_textured() ? Type::TEXTURED_MESH : Type::MESH;
+            record.mesh = mesh_indices[buffers];
+            store_surface(mesh->get_surface());
+            record.color = mesh->get_surface().color;
+        }
+        else if(const Sphere* sphere = dynamic_cast<const Sphere*>(primitive))
+        {
+            record.type = Type::SPHERE;
+            record.points[0] = sphere->get_center().coordinates;
+            record.r = sphere->get_r();
+            store_surface(sphere->get_surface());
+            record.color = sphere->get_surface().color;
+        }
+        else
+            return false;
+    }
+
+    Cache_writer body;
+
+    body.write<uint64_t>(texture_table.size());
+    for(const std::string& path : texture_table)
+        body.write(path);
+
+    body.write<uint64_t>(mesh_table.size());
+    for(const Mesh_buffers* buffers : mesh_table)
+    {
+        uint64_t file_hash;
+
+        if(buffers->source.empty() || !hash_file(buffers->source, file_hash))
+            return false;
+
+        body.write(file_hash);
+        write(body, *buffers);
+    }
+
+    body.write(records);
+    tree.save(body);
+
+    //the body is checksummed, so a damaged file is parsed again instead of being trusted
+    Cache_writer writer;
+
+    writer.write(MAGIC);
+    writer.write(VERSION);
+    writer.write(key);
+    writer.write(scene.acceleration);
+    writer.write(hash(body.get_data().data(), body.get_data().size()));
+    writer.append(body);
+
+    return writer.save(file);
+}
@@ -0,0 +1,65 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <string>
+#include <array>
+#include <cstdint>
+
+#include "tracer.h"
+#include "texture_loader.h"
+#include "acceleration_structure.h"
+#include "triangle_mesh.h"
+#include "cache_io.h"
+
+namespace ray_tracing
+{
+
+//primitives of a scene stored in a binary file together with their acceleration structure,
+//so that the geometry is neither parsed nor built again while its text doesn't change.
+//Textures are stored by path and loaded again. Meshes are stored with their buffers, their paths
+//and the hashes of their files, the cache is stale once any of the files changes
+class Scene_cache
+{
+private:
+    static const char MAGIC[4];
+    static const uint32_t VERSION = 5;
+
+    enum class Type : uint32_t {TRIANGLE, QUADRANGLE, PARALLELOGRAMM, TEXTURED_PARALLELOGRAMM, SPHERE,
+                                MESH, TEXTURED_MESH};
+
+    //every primitive is stored as a record of the same size, the center of a sphere is points[0]
+    struct Record
+    {
+        Type type;
+        Orientation orientation;
+        std::array<std::array<double, Point::AXIS_SIZE>, 4> points;
+        double r;
+        Color color;
+        double alpha, transparency, refraction;
+        //indices in the tables of texture paths and mesh buffers
+        uint32_t texture, mesh;
+        Sampler sampler;
+    };
+
+    static void write(Cache_writer& writer, const Mesh_buffers& buffers);
+    //throws std::runtime_error if the buffers are inconsistent
+    static std::shared_ptr<const Mesh_buffers> read(Cache_reader& reader);
+
+public:
+    //several pieces of data are hashed together by passing the previous result as seed
+    static uint64_t hash(const char* data, size_t size, uint64_t seed = VERSION);
+
+    //fills primitives and the acceleration structure of the scene if the file holds the geometry
+    //with this key. Otherwise the scene remembers the file, and Tracer saves the cache to it
+    //once the structure is built
+    static bool load(const std::string& file, uint64_t key, Scene& scene, Texture_cache& textures);
+    //returns false if the scene has primitives which can't be stored or the file can't be written
+    static bool save(const std::string& file,
+                     uint64_t key,
+                     const Scene& scene,
+                     const Acceleration_structure& tree);
+};
+
+}
+
+#endif // SCENE_CACHE_H
@@ -0,0 +1,107 @@
+#include <cmath>
+#include <algorithm>
+
+#include "texture.h"
+
+//each texel of the result averages a 2 x 2 block of the image
+ray_tracing::Image<ray_tracing::Color> halve(const ray_tracing::Image<ray_tracing::Color>& image)
+{
+    ray_tracing::Image<ray_tracing::Color> result(std::max<size_t>(1, image.height() / 2),
+                                                  std::max<size_t>(1, image.width() / 2));
+
+    for(size_t i = 0; i < result.height(); ++i)
+        for(size_t j = 0; j < result.width(); ++j)
+        {
+            size_t  up = std::min(2 * i + 1, image.height() - 1),
+                    right = std::min(2 * j + 1, image.width() - 1);
+
+            result[i][j] = (image[2 * i][2 * j] + image[2 * i][right] +
+                            image[up][2 * j] + image[up][right]) / 4;
+        }
+
+    return result;
+}
+
+ray_tracing::Texture::Texture(Image<Color>&& image, const Sampler& sampler)
+    : texels(std::make_shared<Texels>()),
+      sampler(sampler)
+{
+    texels->image = std::move(image);
+    build_mipmaps();
+}
+
+//copies sharing the texels may be given samplers from several threads, the levels are built by one of them
+void ray_tracing::Texture::build_mipmaps()
+{
+    if(!texels || sampler.mipmaps == Mipmaps::OFF)
+        return;
+
+    std::call_once(texels->built,
+                   [this]()
+                   {
+                       for(const Image<Color>* last = &texels->image;
+                           last->height() > 1 || last->width() > 1;
+                           last = &texels->mipmaps.back())
+                           texels->mipmaps.push_back(halve(*last));
+                   });
+}
+
+ray_tracing::Color ray_tracing::Texture::texel(const Image<Color>& level, long i, long j) const
+{
+    long    height = level.height(),
+            width = level.width();
+
+    if(sampler.address == Address::WRAP)
+    {
+        i = (i % height + height) % height;
+        j = (j % width + width) % width;
+    }
+    else
+    {
+        i = std::min(std::max(i, 0l), height - 1);
+        j = std::min(std::max(j, 0l), width - 1);
+    }
+
+    return level[i][j];
+}
+
+ray_tracing::Color ray_tracing::Texture::sample(const Image<Color>& level, const std::array<double, 2>& uv) const
+{
+    double  x = uv[0] * level.height(),
+            y = uv[1] * level.width();
+
+    if(sampler.filter == Filter::NEAREST)
+        return texel(level, floor(x), floor(y));
+
+    //texel centers are at half-integer coordinates
+    x -= 0.5;
+    y -= 0.5;
+
+    long    i = floor(x),
+            j = floor(y);
+    float   a = x - i,
+            b = y - j;
+
+    return  (texel(level, i, j) * (1 - b) + texel(level, i, j + 1) * b) * (1 - a) +
+            (texel(level, i + 1, j) * (1 - b) + texel(level, i + 1, j + 1) * b) * a;
+}
+
+ray_tracing::Color ray_tracing::Texture::sample(const std::array<double, 2>& uv, double footprint) const
+{
+    if(sampler.mipmaps == Mipmaps::OFF)
+        return sample(texels->image, uv);
+
+    double index = std::min<double>(log2(std::max(1.0, footprint)), texels->mipmaps.size());
+
+    if(sampler.filter == Filter::NEAREST)
+        return sample(level(lround(index)), uv);
+
+    //bilinear samples of the two closest levels are blended
+    size_t lower = floor(index);
+    float weight = index - lower;
+
+    if(lower == texels->mipmaps.size())
+        return sample(level(lower), uv);
+
+    return sample(level(lower), uv) * (1 - weight) + sample(level(lower + 1), uv) * weight;
+}
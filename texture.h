@@ -0,0 +1,103 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <vector>
+#include <memory>
+#include <array>
+#include <string>
+#include <mutex>
+
+#include "picture.h"
+#include "image.h"
+
+namespace ray_tracing
+{
+
+enum class Filter {NEAREST, BILINEAR};
+//what texture coordinates outside [0, 1] refer to
+enum class Address {WRAP, CLAMP};
+//whether the level sampled is chosen by the footprint of the sample, otherwise the texture itself is
+enum class Mipmaps {OFF, ON};
+
+struct Sampler
+{
+    Filter filter;
+    Address address;
+    Mipmaps mipmaps;
+
+    Sampler(Filter filter = Filter::NEAREST, Address address = Address::CLAMP, Mipmaps mipmaps = Mipmaps::OFF)
+        : filter(filter), address(address), mipmaps(mipmaps)
+    {}
+
+    static Sampler factory(Filter filter, Address address)
+    {
+        return Sampler(filter, address);
+    }
+};
+
+//texels are immutable and shared by all the copies of a texture, copies may only differ in sampler
+class Texture
+{
+private:
+    struct Texels
+    {
+        Image<Color> image;
+        //each level is the previous one halved, the first is the image halved. They are built once,
+        //when a copy of the texture is given a sampler with mipmaps
+        std::vector<Image<Color>> mipmaps;
+        std::once_flag built;
+    };
+
+    std::shared_ptr<Texels> texels;
+    Sampler sampler;
+    //file the texture is loaded from
+    std::string source;
+
+    void build_mipmaps();
+    //level 0 is the image itself
+    const Image<Color>& level(size_t index) const
+    {
+        return index == 0 ? texels->image : texels->mipmaps[index - 1];
+    }
+    Color texel(const Image<Color>& level, long i, long j) const;
+    Color sample(const Image<Color>& level, const std::array<double, 2>& uv) const;
+
+public:
+    Texture()
+    {}
+    Texture(Image<Color>&& image, const Sampler& sampler = Sampler());
+
+    //uv[0] runs along the height and uv[1] along the width. Footprint is the size
+    //of the area the sample covers in texels of the texture, the level is chosen by it with mipmaps
+    Color sample(const std::array<double, 2>& uv, double footprint) const;
+
+    void set_sampler(const Sampler& sampler_)
+    {
+        sampler = sampler_;
+        build_mipmaps();
+    }
+    const Sampler& get_sampler() const
+    {
+        return sampler;
+    }
+    void set_source(const std::string& source_)
+    {
+        source = source_;
+    }
+    const std::string& get_source() const
+    {
+        return source;
+    }
+    size_t height() const
+    {
+        return texels->image.height();
+    }
+    size_t width() const
+    {
+        return texels->image.width();
+    }
+};
+
+}
+
+#endif // TEXTURE_H
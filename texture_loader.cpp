@@ -0,0 +1,314 @@
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+#include "texture_loader.h"
+#include "mapped_file.h"
+
+const char ray_tracing::Texture_header::MAGIC[4] = {'R', 'T', 'E', 'X'};
+
+void check(bool condition)
+{
+    if(!condition)
+        throw std::runtime_error("malformed image");
+}
+
+//a size computed from the header, which is malformed if the product doesn't fit
+size_t checked_product(size_t a, size_t b)
+{
+    check(b == 0 || a <= SIZE_MAX / b);
+    return a * b;
+}
+
+//walks through the whitespace separated header of PPM, PFM and the text format
+class Cursor
+{
+private:
+    const char *it, *end;
+
+public:
+    Cursor(const char* begin, const char* end)
+        : it(begin), end(end)
+    {}
+
+    //skips whitespace and comments
+    void skip()
+    {
+        while(it != end && (isspace(*it) || *it == '#'))
+            if(*it == '#')
+                while(it != end && *it != '\n')
+                    ++it;
+            else
+                ++it;
+    }
+    std::string token()
+    {
+        skip();
+
+        const char* begin = it;
+        while(it != end && !isspace(*it))
+            ++it;
+
+        return std::string(begin, it);
+    }
+    //a truncated, malformed or too large number is an error rather than 0 or a wrapped value
+    unsigned long number()
+    {
+        skip();
+
+        unsigned long result = 0;
+        std::from_chars_result read = std::from_chars(it, end, result);
+        check(read.ec == std::errc());
+
+        it = read.ptr;
+
+        return result;
+    }
+    //height or width of an image, bounded like the ones of the binary format
+    size_t dimension()
+    {
+        unsigned long result = number();
+        check(result <= UINT32_MAX);
+
+        return result;
+    }
+    //numbers left in a text image can't be more than the characters left
+    size_t left() const
+    {
+        return end - it;
+    }
+    //binary data starts after a single whitespace character
+    const char* data()
+    {
+        check(it != end);
+        return it + 1;
+    }
+    const char* position() const
+    {
+        return it;
+    }
+};
+
+bool little_endian()
+{
+    uint16_t x = 1;
+    return *reinterpret_cast<const char*>(&x) == 1;
+}
+
+ray_tracing::Image<ray_tracing::Color> load_binary(const char* data, size_t size)
+{
+    ray_tracing::Texture_header header;
+
+    check(size >= sizeof(header));
+    memcpy(&header, data, sizeof(header));
+    check(header.format <= ray_tracing::Texel_format::FLOAT);
+
+    size_t texel_size = header.format == ray_tracing::Texel_format::RGB8 ? 3 :
+                        header.format == ray_tracing::Texel_format::RGBA8 ? 4 :
+                                                                            sizeof(ray_tracing::Color);
+    const char* texels = data + sizeof(header);
+
+    check(size - sizeof(header) >= checked_product(checked_product(header.height, header.width), texel_size));
+
+    ray_tracing::Image<ray_tracing::Color> image(header.height, header.width);
+
+    for(size_t i = 0; i < image.height(); ++i)
+    {
+        const char* row = texels + i * header.width * texel_size;
+
+        if(header.format == ray_tracing::Texel_format::FLOAT)
+        {
+            memcpy(image[i].begin(), row, header.width * texel_size);
+            continue;
+        }
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(row);
+        for(size_t j = 0; j < image.width(); ++j, bytes += texel_size)
+            image[i][j] = ray_tracing::Color(bytes[0], bytes[1], bytes[2]) / 255;
+    }
+
+    return image;
+}
+
+ray_tracing::Image<ray_tracing::Color> load_ppm(Cursor& cursor, bool binary, const char* end)
+{
+    size_t  width = cursor.dimension(),
+            height = cursor.dimension();
+    float max_value = cursor.number();
+
+    check(max_value > 0);
+    //samples are 3 per pixel, in P3 each takes a digit and a separator at least
+    size_t samples = checked_product(checked_product(height, width), 3);
+    check(binary || samples <= cursor.left());
+
+    ray_tracing::Image<ray_tracing::Color> image(height, width);
+
+    //rows are stored top down
+    if(!binary)
+    {
+        for(size_t i = height; i-- > 0;)
+            for(ray_tracing::Color& c : image[i])
+            {
+                c.r = cursor.number() / max_value;
+                c.g = cursor.number() / max_value;
+                c.b = cursor.number() / max_value;
+            }
+
+        return image;
+    }
+
+    size_t sample_size = max_value < 256 ? 1 : 2;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(cursor.data());
+
+    check(size_t(end - cursor.data()) >= checked_product(samples, sample_size));
+
+    auto sample = [&bytes, sample_size, max_value]()
+                  {
+                      unsigned value = sample_size == 1 ? bytes[0] : bytes[0] << 8 | bytes[1];
+                      bytes += sample_size;
+
+                      return value / max_value;
+                  };
+
+    for(size_t i = height; i-- > 0;)
+        for(ray_tracing::Color& c : image[i])
+        {
+            c.r = sample();
+            c.g = sample();
+            c.b = sample();
+        }
+
+    return image;
+}
+
+ray_tracing::Image<ray_tracing::Color> load_pfm(Cursor& cursor, bool grey, const char* end)
+{
+    size_t  width = cursor.dimension(),
+            height = cursor.dimension();
+    std::string scale = cursor.token();
+    double scale_value = 0;
+    std::from_chars_result read = std::from_chars(scale.data(), scale.data() + scale.size(), scale_value);
+    check(read.ec == std::errc() && read.ptr == scale.data() + scale.size());
+    //negative scale means little endian data
+    bool swap = (scale_value < 0) != little_endian();
+    size_t channels = grey ? 1 : 3;
+
+    const char* data = cursor.data();
+    check(size_t(end - data) >= checked_product(checked_product(checked_product(height, width), channels),
+                                                sizeof(float)));
+
+    ray_tracing::Image<ray_tracing::Color> image(height, width);
+
+    //rows are stored bottom up
+    for(size_t i = 0; i < height; ++i)
+        for(ray_tracing::Color& c : image[i])
+        {
+            std::array<float, 3> values;
+
+            for(size_t k = 0; k < channels; ++k, data += sizeof(float))
+            {
+                char bytes[sizeof(float)];
+                memcpy(bytes, data, sizeof(float));
+
+                if(swap)
+                    std::reverse(bytes, bytes + sizeof(float));
+
+                memcpy(&values[k], bytes, sizeof(float));
+            }
+
+            c = grey ? ray_tracing::Color(values[0], values[0], values[0]) :
+                       ray_tracing::Color(values[0], values[1], values[2]);
+        }
+
+    return image;
+}
+
+ray_tracing::Image<ray_tracing::Color> load_text(Cursor& cursor)
+{
+    size_t  height = cursor.dimension(),
+            width = cursor.dimension();
+
+    check(checked_product(checked_product(height, width), 3) <= cursor.left());
+
+    ray_tracing::Image<ray_tracing::Color> image(height, width);
+
+    for(size_t i = 0; i < height; ++i)
+        for(ray_tracing::Color& c : image[i])
+        {
+            c.r = cursor.number();
+            c.g = cursor.number();
+            c.b = cursor.number();
+            c /= 255;
+        }
+
+    return image;
+}
+
+ray_tracing::Image<ray_tracing::Color> ray_tracing::load_image(const std::string& file)
+{
+    Mapped_file mapped(file);
+    const char  *data = mapped.data(),
+                *end = data + mapped.size();
+
+    if(!mapped.is_open())
+        throw std::runtime_error("can't open " + file);
+
+    if(mapped.size() >= sizeof(Texture_header) &&
+       std::equal(Texture_header::MAGIC, Texture_header::MAGIC + 4, data))
+        return load_binary(data, mapped.size());
+
+    Cursor cursor(data, end);
+
+    if(mapped.size() >= 2 && data[0] == 'P')
+    {
+        std::string magic = cursor.token();
+
+        if(magic == "P3" || magic == "P6")
+            return load_ppm(cursor, magic == "P6", end);
+
+        check(magic == "PF" || magic == "Pf");
+        return load_pfm(cursor, magic == "Pf", end);
+    }
+
+    return load_text(cursor);
+}
+
+ray_tracing::Texture ray_tracing::Texture_cache::load(const std::string& file)
+{
+    std::promise<Texture> promise;
+    std::shared_future<Texture> texture;
+    bool loaded;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, std::shared_future<Texture>>::iterator it = textures.find(file);
+
+        loaded = it != textures.end();
+        if(loaded)
+            texture = it->second;
+        else
+            textures.emplace(file, texture = promise.get_future().share());
+    }
+
+    //waits for the thread decoding the file, if it is another one
+    if(loaded)
+        return texture.get();
+
+    try
+    {
+        Texture result(load_image(file));
+        result.set_source(file);
+
+        promise.set_value(result);
+    }
+    catch(...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+
+    return texture.get();
+}
@@ -0,0 +1,50 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <future>
+#include <cstdint>
+#include <cstddef>
+
+#include "texture.h"
+#include "image.h"
+
+namespace ray_tracing
+{
+
+enum class Texel_format : uint32_t {RGB8, RGBA8, FLOAT};
+
+//header of the binary texture format. It is followed by height rows of width texels,
+//the first row is the bottom one. FLOAT texels are 3 floats, alpha of RGBA8 is ignored
+struct Texture_header
+{
+    static const char MAGIC[4];
+
+    char magic[4];
+    Texel_format format;
+    uint32_t height, width;
+};
+
+//decodes the binary format, PPM (P3 and P6), PFM (PF and Pf) and the text format
+//of a height, a width and three integers per texel. Rows of the result go bottom up.
+//Throws std::runtime_error if the file can't be read or decoded
+Image<Color> load_image(const std::string& file);
+
+//each file is loaded once, textures loaded from the same path share their texels.
+//The cache may be used from several threads: a file is decoded outside the lock by the first thread
+//asking for it, the others asking for the same file wait for it meanwhile
+class Texture_cache
+{
+private:
+    std::map<std::string, std::shared_future<Texture>> textures;
+    std::mutex mutex;
+
+public:
+    Texture load(const std::string& file);
+};
+
+}
+
+#endif // TEXTURE_LOADER_H
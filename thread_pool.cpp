@@ -0,0 +1,110 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include "thread_pool.h"
+
+thread_local const ray_tracing::Thread_pool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+ray_tracing::Thread_pool::Thread_pool(size_t workers_num)
+    : pending(0),
+      next_queue(0),
+      stopped(false)
+{
+    workers_num = std::max<size_t>(workers_num, 1);
+
+    for(size_t i = 0; i < workers_num; ++i)
+        queues.emplace_back(new Queue());
+
+    for(size_t i = 0; i < workers_num; ++i)
+        workers.emplace_back(&Thread_pool::work, this, i);
+}
+
+ray_tracing::Thread_pool::~Thread_pool()
+{
+    mutex.lock();
+    stopped = true;
+    condition_variable.notify_all();
+    mutex.unlock();
+
+    std::for_each(workers.begin(), workers.end(), [](std::thread& thread) {thread.join();});
+}
+
+size_t ray_tracing::Thread_pool::worker_index() const
+{
+    return current_pool == this ? current_index : queues.size();
+}
+
+void ray_tracing::Thread_pool::submit(Task task)
+{
+    size_t index = worker_index();
+    if(index == queues.size())
+        index = next_queue++ % queues.size();
+
+    queues[index]->mutex.lock();
+    queues[index]->tasks.push_back(std::move(task));
+    queues[index]->mutex.unlock();
+
+    ++pending;
+
+    mutex.lock();
+    condition_variable.notify_one();
+    mutex.unlock();
+}
+
+bool ray_tracing::Thread_pool::run_pending_task()
+{
+    size_t index = worker_index();
+    Task task;
+
+    if(index != queues.size())
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+
+        if(!queues[index]->tasks.empty())
+        {
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+        }
+    }
+
+    for(size_t i = 1; i <= queues.size() && !task; ++i)
+    {
+        Queue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if(!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+
+    if(!task)
+        return false;
+
+    --pending;
+    task();
+
+    return true;
+}
+
+void ray_tracing::Thread_pool::work(size_t index)
+{
+    current_pool = this;
+    current_index = index;
+
+    while(true)
+    {
+        if(run_pending_task())
+            continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stopped && pending == 0)
+            condition_variable.wait(lock);
+
+        if(stopped && pending == 0)
+            return;
+    }
+}
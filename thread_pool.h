@@ -0,0 +1,148 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+namespace ray_tracing
+{
+
+//persistent workers with a task deque each. Workers take their own tasks from the back
+//and steal other workers' tasks from the front when they run out of them
+class Thread_pool
+{
+public:
+    typedef std::function<void()> Task;
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    std::atomic<size_t> pending, next_queue;
+    bool stopped;
+
+    void work(size_t index);
+
+public:
+    Thread_pool(size_t workers_num = std::thread::hardware_concurrency());
+    ~Thread_pool();
+
+    Thread_pool(const Thread_pool&) = delete;
+    Thread_pool& operator=(const Thread_pool&) = delete;
+
+    size_t size() const
+    {
+        return queues.size();
+    }
+    //index of the worker the current thread is, size() for the other threads
+    size_t worker_index() const;
+
+    //the task is expected not to throw, the ones of parallel_for catch the exceptions of its function
+    void submit(Task task);
+    //runs one queued task on the calling thread, returns false if there are none
+    bool run_pending_task();
+
+    //calls function(i) for every i in [0, size), indices are handed out dynamically.
+    //The calling thread takes part in the work, so parallel_for may be nested.
+    //If function throws, the indices not started yet are skipped and the first exception
+    //is rethrown on the calling thread once every task has finished
+    template<typename F>
+    void parallel_for(size_t size, F function);
+};
+
+template<typename F>
+void Thread_pool::parallel_for(size_t size, F function)
+{
+    //the tasks reference the locals, so they are waited for even if function throws
+    std::atomic<size_t> next(0), running(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    //the first exception is kept, the indices left are skipped
+    auto fail = [&next, &error_mutex, &error, size]()
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if(!error)
+                        error = std::current_exception();
+
+                    next = size;
+                };
+    auto body = [&next, &function, &fail, size]()
+                {
+                    try
+                    {
+                        for(size_t i = next++; i < size; i = next++)
+                            function(i);
+                    }
+                    catch(...)
+                    {
+                        fail();
+                    }
+                };
+
+    try
+    {
+        for(size_t i = std::min(size, queues.size()); i > 0; --i)
+        {
+            ++running;
+            submit([this, &body, &running]()
+                   {
+                       body();
+
+                       if(--running == 0)
+                       {
+                           std::lock_guard<std::mutex> lock(mutex);
+                           condition_variable.notify_all();
+                       }
+                   });
+        }
+    }
+    catch(...)
+    {
+        //the task which failed to be queued
+        --running;
+        fail();
+    }
+
+    body();
+
+    //the tasks not taken yet are run here, otherwise the thread sleeps until another task is queued
+    //or the last one of its own finishes
+    while(running != 0)
+    {
+        if(run_pending_task())
+            continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condition_variable.wait(lock, [this, &running]() {return pending != 0 || running == 0;});
+    }
+
+    //a wakeup for a task queued meanwhile may have been taken here, it is passed on
+    if(pending != 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        condition_variable.notify_one();
+    }
+
+    if(error)
+        std::rethrow_exception(error);
+}
+}
+
+#endif // THREAD_POOL_H
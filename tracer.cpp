@@ -2,34 +2,50 @@
 #include <memory>
 #include <thread>
 #include <algorithm>
-#include <future>
-#include <map>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <atomic>
+#include <utility>
+#include <chrono>
 
 #include "tracer.h"
-#include "kd_tree.h"
-#include "continuous_performer.h"
-
-ray_tracing::Light::Light_force
-    ray_tracing::Tracer::light_force(const std::shared_ptr<Primitive>& primitive, const Ray& ray) const
+#include "acceleration_structure.h"
+#include "thread_pool.h"
+#include "scene_cache.h"
+#include "render_statistics.h"
+
+const std::array<ray_tracing::Quality, 4> ray_tracing::Tracer::BUDGET_LEVELS{{Quality(1, 1, false),
+                                                                                Quality(3, 1, false),
+                                                                                Quality(Quality::TRACE_DEPTH,
+                                                                                        Quality::TRACE_DEPTH,
+                                                                                        false),
+                                                                                Quality()}};
+
+ray_tracing::Light::Light_force ray_tracing::Tracer::light_force(const Hit& hit, const Ray& ray, bool shadows) const
 {
     Light::Light_force light_force = Light::DARKNESS;
-    Point point = primitive->intersect(ray);
 
     for(const Light& l : scene.lights)
     {
-        Ray light_ray(l.place, point);
+        Ray light_ray(l.place, hit.point);
 
-        std::shared_ptr<Primitive> light_intersection = tree.trace(light_ray);
-        if(!light_intersection)
+        //the light and the observer are to be on the same side of the surface
+        if(hit.primitive->side(light_ray, hit) != hit.side)
             continue;
 
-        if(light_intersection->intersect(light_ray) == point &&
-           light_intersection->side(light_ray) == primitive->side(ray))
+        if(shadows)
         {
-            light_force += l.calculate(primitive->angle_cos(light_ray),
-                                       angle_cos(-ray.guiding(), primitive->reflect(light_ray).guiding()),
-                                       point);
+            if(Render_statistics* counters = thread_statistics)
+                ++counters->shadow_rays;
+
+            if(tree->occluded(Ray(hit.point, l.place), 1))
+                continue;
         }
+
+        light_force += l.calculate(fabs(angle_cos(hit.normal, light_ray.guiding())),
+                                   angle_cos(-ray.guiding(), reflect(light_ray, hit.point, hit.normal).guiding()),
+                                   hit.point);
     }
 
     return light_force;
@@ -43,135 +59,622 @@ ray_tracing::Ray ray_tracing::Tracer::produce_ray(double i, double j) const
                (scene.viewport.right_down - scene.viewport.left_down) * j / scene.viewport.width);
 }
 
-ray_tracing::Color ray_tracing::Tracer::trace(const Ray& ray, size_t depth) const
+ray_tracing::Color ray_tracing::Tracer::trace(const Ray& ray, const Ray_cone& cone, size_t depth) const
 {
     if(depth == 0)
         return Color::BLACK;
 
-    std::shared_ptr<Primitive> intersection = tree.trace(ray);
-    if(!intersection)
+    if(Render_statistics* counters = thread_statistics)
+        ++(depth == quality.trace_depth ? counters->primary_rays : counters->secondary_rays);
+
+    return shade(ray, tree->trace(ray), cone, depth);
+}
+
+ray_tracing::Color ray_tracing::Tracer::trace_primary(const Ray& ray) const
+{
+    return trace(ray, pixel_cone(ray), quality.trace_depth);
+}
+
+//primary rays end on the screen at coefficient 1, where the footprint is a pixel wide
+ray_tracing::Ray_cone ray_tracing::Tracer::pixel_cone(const Ray& ray) const
+{
+    return Ray_cone{0, pixel_size / ray.guiding().mod()};
+}
+
+ray_tracing::Color ray_tracing::Tracer::shade(const Ray& ray, Hit hit, const Ray_cone& cone, size_t depth) const
+{
+    if(!hit.primitive)
         return Color::BLACK;
 
-    Point intersection_point = intersection->intersect(ray);
-    Color intersection_color = intersection->get_color(intersection_point);
+    hit.footprint = cone.at(hit.coefficient * ray.guiding().mod());
+    //secondary rays start with the footprint of the hit, surfaces are assumed to be flat
+    Ray_cone secondary{hit.footprint, cone.spread};
+
+    Color intersection_color = hit.primitive->get_color(hit);
 
-    double  alpha = intersection->get_alpha(),
-            transparency = intersection->get_transparency();
+    double  alpha = hit.primitive->get_alpha(hit),
+            transparency = hit.primitive->get_transparency(hit);
     Color result;
 
+    bool shadows = quality.trace_depth - depth < quality.shadow_depth;
+
     if(!eq_zero(1 - alpha) && intersection_color != Color::BLACK)
-        result += intersection_color * (1 - alpha) * light_force(intersection, ray);
+        result += intersection_color * (1 - alpha) * light_force(hit, ray, shadows);
 
     if(!eq_zero(alpha))
-        result += trace(intersection->reflect(ray).correct(), depth - 1) * alpha;
+        result += trace(reflect(ray, hit.point, hit.normal).correct(), secondary, depth - 1) * alpha;
 
     if(!eq_zero(transparency))
-        result += trace(intersection->refract(ray).correct(), depth - 1) * transparency;
+        result += trace(hit.primitive->refract(ray, hit).correct(), secondary, depth - 1) * transparency;
 
     return result;
 }
 
-void ray_tracing::Tracer::produce_picture_helper(size_t from, size_t to)
+//primary rays of PACKET_ROWS x PACKET_COLUMNS pixel blocks are traced as packets
+bool ray_tracing::Tracer::trace_pixels(const Tile& tile, std::vector<Color>& colors, const Render_control& control) const
 {
-    for(size_t i = from; i < to; ++i)
-        for(size_t j = 0; j < matrix.width(); ++j)
-            matrix[i][j] = trace(produce_ray(i + 0.5, j + 0.5), TRACE_DEPTH);
-}
+    size_t width = tile.column_to - tile.column_from;
+    colors.resize((tile.row_to - tile.row_from) * width);
 
-void ray_tracing::Tracer::anti_aliasing_determinant(size_t from, size_t to)
-{
-    for(size_t i = from; i < to; ++i)
-        for(size_t j = 0; j < matrix.width(); ++j)
+    for(size_t i = tile.row_from; i < tile.row_to; i += PACKET_ROWS)
+        for(size_t j = tile.column_from; j < tile.column_to; j += PACKET_COLUMNS)
         {
-            std::vector<Color> loc;
+            if(control.is_stopped())
+                return false;
+
+            std::array<Ray, Ray_packet::SIZE> rays;
+            std::array<size_t, Ray_packet::SIZE> pixels;
+            size_t size = 0;
 
-            for(int k = -1; k < 2; ++k)
-                for(int b = -1; b < 2; ++b)
+            for(size_t k = i; k < std::min(tile.row_to, i + PACKET_ROWS); ++k)
+                for(size_t l = j; l < std::min(tile.column_to, j + PACKET_COLUMNS); ++l)
                 {
-                    int new_i = i + k, new_j = j + b;
-                    if(0 <= new_i && new_i < matrix.height() &&
-                       0 <= new_j && new_j < matrix.width())
-                        loc.push_back(matrix[new_i][new_j]);
+                    pixels[size] = (k - tile.row_from) * width + l - tile.column_from;
+                    rays[size++] = produce_ray(k + 0.5, l + 0.5);
                 }
 
-            Color expectation, variance;
+            if(Render_statistics* counters = thread_statistics)
+                counters->primary_rays += size;
+
+            std::array<Hit, Ray_packet::SIZE> hits = tree->trace(Ray_packet(rays, size));
+
+            for(size_t k = 0; k < size; ++k)
+                colors[pixels[k]] = shade(rays[k], hits[k], pixel_cone(rays[k]), quality.trace_depth);
+        }
+
+    return true;
+}
+
+//uniform number in [0, 1) determined by its arguments, so stratified sampling
+//doesn't depend on the order the tiles are rendered in
+double jitter(size_t i, size_t j, size_t k)
+{
+    uint64_t x = (uint64_t(i) * 0x9e3779b97f4a7c15ull) ^ (uint64_t(j) * 0xbf58476d1ce4e5b9ull) ^ k;
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return (x >> 11) * (1.0 / (uint64_t(1) << 53));
+}
+
+ray_tracing::Color ray_tracing::Tracer::supersample(const Tile& tile,
+                                                     size_t i,
+                                                     size_t j,
+                                                     const Color& center,
+                                                     Lattice& lattice) const
+{
+    const Anti_aliasing& anti_aliasing = scene.anti_aliasing;
+    Color result;
+
+    if(anti_aliasing.pattern == Sample_pattern::ROTATED_GRID)
+    {
+        static const std::array<std::array<double, 2>, 4> OFFSETS{{{0.125, 0.625},
+                                                                     {0.375, 0.125},
+                                                                     {0.625, 0.875},
+                                                                     {0.875, 0.375}}};
+
+        for(const std::array<double, 2>& offset : OFFSETS)
+            result += trace_primary(produce_ray(i + offset[0], j + offset[1]));
+
+        return result / OFFSETS.size();
+    }
+
+    size_t samples = anti_aliasing.samples;
 
-            for(const Color& color : loc)
+    if(anti_aliasing.pattern == Sample_pattern::STRATIFIED)
+    {
+        for(size_t g = 0; g < samples; ++g)
+            for(size_t h = 0; h < samples; ++h)
+                result += trace_primary(produce_ray(i + (g + jitter(i, j, 2 * (g * samples + h))) / samples,
+                                                    j + (h + jitter(i, j, 2 * (g * samples + h) + 1)) / samples));
+
+        return result / (samples * samples);
+    }
+
+    //lattice points lie on the borders of the pixel, the middle one for odd samples is its center
+    size_t cells = samples - 1;
+
+    if(lattice.colors.empty())
+    {
+        lattice.cells = cells;
+        lattice.width = (tile.column_to - tile.column_from) * cells + 1;
+        lattice.colors.resize(((tile.row_to - tile.row_from) * cells + 1) * lattice.width);
+        lattice.traced.resize(lattice.colors.size());
+    }
+
+    for(size_t g = 0; g <= cells; ++g)
+        for(size_t h = 0; h <= cells; ++h)
+        {
+            if(2 * g == cells && 2 * h == cells)
             {
-                expectation += color;
-                variance += color * color;
+                result += center;
+                continue;
             }
 
-            variance = variance / loc.size() - expectation * expectation / pow(loc.size(), 2.0);
+            size_t index = ((i - tile.row_from) * cells + g) * lattice.width + (j - tile.column_from) * cells + h;
+
+            if(!lattice.traced[index])
+            {
+                lattice.colors[index] = trace_primary(produce_ray(i + double(g) / cells, j + double(h) / cells));
+                lattice.traced[index] = true;
+            }
 
-            if(variance.mod() > ANTI_ALIASING_BOUND)
-                determinant_matrix[i][j] = true;
+            result += lattice.colors[index];
         }
+
+    return result / (samples * samples);
+}
+
+//phases of rendering a tile are only timed if statistics are collected
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
-void ray_tracing::Tracer::anti_aliasing_performer(size_t from, size_t to)
+bool ray_tracing::Tracer::render_tile(const Tile& tile, const Render_control& control)
 {
-    std::map<std::array<double, 2>, Color> additionally_traced_rays;
+    Render_statistics* counters = thread_statistics;
+    std::chrono::steady_clock::time_point start;
+
+    if(counters)
+    {
+        counters->pixels += (tile.row_to - tile.row_from) * (tile.column_to - tile.column_from);
+        start = std::chrono::steady_clock::now();
+    }
+
+    if(!quality.supersampling)
+    {
+        std::vector<Color> colors;
+        bool completed = trace_pixels(tile, colors, control);
+
+        if(counters)
+            counters->phase_times[Render_statistics::TRACE] += seconds_since(start);
+
+        if(!completed)
+            return false;
+
+        for(size_t i = tile.row_from; i < tile.row_to; ++i)
+            std::copy(colors.begin() + (i - tile.row_from) * (tile.column_to - tile.column_from),
+                      colors.begin() + (i - tile.row_from + 1) * (tile.column_to - tile.column_from),
+                      matrix[i].begin() + tile.column_from);
+
+        return true;
+    }
+
+    //variance is estimated over 3 x 3 neighbourhoods, so the tile is traced with a border of one pixel
+    Tile border{tile.row_from == 0 ? 0 : tile.row_from - 1,
+                std::min(matrix.height(), tile.row_to + 1),
+                tile.column_from == 0 ? 0 : tile.column_from - 1,
+                std::min(matrix.width(), tile.column_to + 1)};
+    size_t width = border.column_to - border.column_from;
+
+    std::vector<Color> colors;
+    bool completed = true;
+
+    if(reusing)
+        for(size_t i = border.row_from; i < border.row_to; ++i)
+            colors.insert(colors.end(),
+                          reused_pixels[i].begin() + border.column_from,
+                          reused_pixels[i].begin() + border.column_to);
+    else
+        completed = trace_pixels(border, colors, control);
+
+    if(counters)
+    {
+        counters->phase_times[Render_statistics::TRACE] += seconds_since(start);
+        start = std::chrono::steady_clock::now();
+    }
 
-    for(size_t i = from; i < to; ++i)
-        for(size_t j = 0; j < determinant_matrix[i].size(); ++j)
+    if(!completed)
+        return false;
+
+    Lattice lattice{};
+    //time of supersampling within the loop, the rest of it is finding the pixels to supersample
+    double resolve_time = 0;
+
+    //the rows supersampled before the control stops are kept, the others are left as they are
+    for(size_t i = tile.row_from; i < tile.row_to; ++i)
+    {
+        if(control.is_stopped())
         {
-            if(!determinant_matrix[i][j])
-                continue;
+            completed = false;
+            break;
+        }
 
-            Color result;
-            for(int g = 0; g < 3; ++g)
-                for(int h = 0; h < 3; ++h)
-                {
-                    if(g == 1 && h == 1)
-                        continue;
+        for(size_t j = tile.column_from; j < tile.column_to; ++j)
+        {
+            Color expectation, variance;
+            size_t neighbours_num = 0;
 
-                    double x = i + 0.5 * g, y = j + 0.5 * h;
-                    auto iter = additionally_traced_rays.find({x, y});
+            for(size_t k = std::max(i, border.row_from + 1) - 1; k < std::min(i + 2, border.row_to); ++k)
+                for(size_t l = std::max(j, border.column_from + 1) - 1; l < std::min(j + 2, border.column_to); ++l)
+                {
+                    const Color& color = colors[(k - border.row_from) * width + l - border.column_from];
 
-                    if(iter != additionally_traced_rays.end())
-                        result += iter->second;
-                    else
-                        result += additionally_traced_rays[std::array<double, 2>{x, y}] =
-                                    trace(produce_ray(x, y), TRACE_DEPTH);
+                    expectation += color;
+                    variance += color * color;
+                    ++neighbours_num;
                 }
 
-            matrix[i][j] = (result + matrix[i][j]) / 9;
+            variance = variance / neighbours_num - expectation * expectation / pow(neighbours_num, 2.0);
+
+            const Color& center = colors[(i - border.row_from) * width + j - border.column_from];
+
+            if(!(variance.mod() > scene.anti_aliasing.threshold))
+            {
+                matrix[i][j] = center;
+                continue;
+            }
+
+            if(!counters)
+            {
+                matrix[i][j] = supersample(tile, i, j, center, lattice);
+                continue;
+            }
+
+            std::chrono::steady_clock::time_point resolve_start = std::chrono::steady_clock::now();
+            matrix[i][j] = supersample(tile, i, j, center, lattice);
+            resolve_time += seconds_since(resolve_start);
+            ++counters->supersampled_pixels;
         }
+    }
+
+    if(counters)
+    {
+        counters->phase_times[Render_statistics::AA_RESOLVE] += resolve_time;
+        counters->phase_times[Render_statistics::AA_DETECTION] += seconds_since(start) - resolve_time;
+    }
+
+    return completed;
 }
 
+bool ray_tracing::Tracer::preview_tile(const Tile& tile, size_t block, const Render_control& control)
+{
+    Render_statistics* counters = thread_statistics;
+    std::chrono::steady_clock::time_point start;
+
+    if(counters)
+        start = std::chrono::steady_clock::now();
+
+    bool completed = true;
+
+    for(size_t i = tile.row_from; i < tile.row_to; i += block)
+    {
+        if(control.is_stopped())
+        {
+            completed = false;
+            break;
+        }
+
+        for(size_t j = tile.column_from; j < tile.column_to; j += block)
+        {
+            bool traced = block < COARSEST_BLOCK &&
+                          (i - tile.row_from) % (2 * block) == 0 &&
+                          (j - tile.column_from) % (2 * block) == 0;
+            Color color = traced ? matrix[i][j] : trace_primary(produce_ray(i + 0.5, j + 0.5));
+
+            for(size_t k = i; k < std::min(tile.row_to, i + block); ++k)
+                for(size_t l = j; l < std::min(tile.column_to, j + block); ++l)
+                    matrix[k][l] = color;
+        }
+    }
+
+    if(counters)
+        counters->phase_times[Render_statistics::TRACE] += seconds_since(start);
+
+    return completed;
+}
+
+//tiles are taken by the threads one by one, so a thread finished with cheap tiles
+//takes over the remaining ones instead of idling
+template<typename F>
+bool ray_tracing::Tracer::parallel_perform(F function, const Render_control& control)
+{
+    std::atomic<size_t> performed(0);
+
+    pool->parallel_for(tiles.size(),
+                      [this, &function, &control, &performed](size_t i)
+                      {
+                          if(control.is_stopped())
+                              return;
+
+                          //every thread counts into counters of its own while it renders the tile
+                          if(collecting)
+                          {
+                              thread_statistics = &thread_counters[pool->worker_index()];
+                              ++thread_statistics->tiles;
+                          }
+
+                          if(function(tiles[i]))
+                              ++performed;
+
+                          thread_statistics = nullptr;
+                      });
+
+    return performed == tiles.size();
+}
+
+//every level renders the tiles over the previous one, so the tiles a level has rendered
+//before the control stopped are kept at its quality and the others at the previous one
 template<typename F>
-void ray_tracing::Tracer::parallel_perform(F function)
+ray_tracing::Render_result ray_tracing::Tracer::render_tiles(const Render_control& control, bool previews, F publish)
+{
+    auto render = [this, &publish, &control](const Tile& tile)
+                  {
+                      bool rendered = render_tile(tile, control);
+                      publish(tile);
+
+                      return rendered;
+                  };
+
+    Render_result result{Matrix(), BUDGET_LEVELS.front(), COARSEST_BLOCK, false};
+
+    if(!control.is_adaptive() && !previews)
+    {
+        quality = result.quality = Quality();
+        result.block = 1;
+        result.complete = parallel_perform(render, control);
+
+        return result;
+    }
+
+    //previews are traced at the lowest quality, so that they are shown sooner. With a budget the coarsest
+    //one is rendered whatever the control, so that the picture is covered by the time it stops
+    quality = BUDGET_LEVELS.front();
+    Render_control unstopped;
+
+    for(size_t block = COARSEST_BLOCK; block >= FINEST_BLOCK; block /= 2)
+    {
+        const Render_control& preview_control = control.is_adaptive() && block == COARSEST_BLOCK ? unstopped :
+                                                                                                  control;
+        auto preview = [this, &publish, &preview_control, block](const Tile& tile)
+                       {
+                           bool previewed = preview_tile(tile, block, preview_control);
+                           publish(tile);
+
+                           return previewed;
+                       };
+
+        if(!parallel_perform(preview, preview_control))
+            return result;
+
+        result.block = block;
+    }
+
+    std::vector<Quality> levels(1, Quality());
+    if(control.is_adaptive())
+        levels.assign(BUDGET_LEVELS.begin(), BUDGET_LEVELS.end());
+
+    for(size_t i = 0; i < levels.size(); ++i)
+    {
+        quality = levels[i];
+        //the previous level has traced every pixel, as the levels stop at the first one which doesn't
+        reusing = i != 0 &&
+                  quality.supersampling &&
+                  quality.trace_depth == levels[i - 1].trace_depth &&
+                  quality.shadow_depth == levels[i - 1].shadow_depth;
+
+        if(reusing)
+            reused_pixels = matrix;
+
+        if(!parallel_perform(render, control))
+            break;
+
+        result.quality = quality;
+        result.block = 1;
+        result.complete = true;
+    }
+
+    reusing = false;
+    reused_pixels = Matrix();
+
+    return result;
+}
+
+//interleaves bits of row and column, so tiles close in the order are close in the picture
+uint64_t morton_code(uint32_t row, uint32_t column)
+{
+    uint64_t result = 0;
+
+    for(size_t i = 0; i < 32; ++i)
+        result |= (uint64_t(row >> i & 1) << (2 * i + 1)) | (uint64_t(column >> i & 1) << (2 * i));
+
+    return result;
+}
+
+std::vector<ray_tracing::Tile> ray_tracing::Tracer::make_tiles(size_t height, size_t width, size_t tile_size)
 {
-    size_t tasks_num = matrix.width() * matrix.height() / RAYS_PER_SECOND;
+    std::vector<std::pair<uint64_t, Tile>> ordered;
 
-    if(tasks_num == 0)
-        tasks_num = 1;
+    for(size_t i = 0; i < height; i += tile_size)
+        for(size_t j = 0; j < width; j += tile_size)
+            ordered.emplace_back(morton_code(i / tile_size, j / tile_size),
+                                 Tile{i, std::min(height, i + tile_size), j, std::min(width, j + tile_size)});
 
-    std::vector<std::future<void>> tasks;
+    std::sort(ordered.begin(), ordered.end(),
+              [](const std::pair<uint64_t, Tile>& a, const std::pair<uint64_t, Tile>& b)
+              {
+                  return a.first < b.first;
+              });
 
-    size_t chunk_size = matrix.height() / tasks_num;
-    for(size_t i = 0; i + 1 < tasks_num; ++i)
-        tasks.push_back(std::async(  std::launch::deferred,
-                                     function,
-                                     this,
-                                     i * chunk_size,
-                                     (i + 1) * chunk_size));
+    std::vector<Tile> result;
+    for(const std::pair<uint64_t, Tile>& tile : ordered)
+        result.push_back(tile.second);
 
-    tasks.push_back(std::async(  std::launch::deferred,
-                                 function,
-                                 this,
-                                 (tasks_num - 1) * chunk_size,
-                                 matrix.height()));
+    return result;
+}
+
+void ray_tracing::Tracer::save_cache() const
+{
+    if(!scene.cache_file.empty() && !Scene_cache::save(scene.cache_file, scene.cache_key, scene, *tree))
+        std::cerr << "can't save scene cache to " << scene.cache_file << std::endl;
+}
+
+void ray_tracing::Tracer::set_viewport(const Viewport& viewport)
+{
+    scene.viewport = viewport;
+
+    if(matrix.height() != viewport.height || matrix.width() != viewport.width || matrix.empty())
+    {
+        matrix = Matrix(viewport.height, viewport.width);
+        tiles = make_tiles(matrix.height(), matrix.width(), scene.tile_size);
+    }
 
-    performer.continuous_perform(tasks);
+    pixel_size = std::max((viewport.left_up - viewport.left_down).mod() / viewport.height,
+                          (viewport.right_down - viewport.left_down).mod() / viewport.width);
+}
+
+void ray_tracing::Tracer::add_instance(const Primitive* primitive)
+{
+    if(const Instance* instance = dynamic_cast<const Instance*>(primitive))
+        instances.push_back(instance);
+}
+
+void ray_tracing::Tracer::add_primitive(const std::shared_ptr<Primitive>& primitive)
+{
+    scene.primitives.push_back(primitive);
+    add_instance(primitive.get());
+    changed = true;
+}
+
+void ray_tracing::Tracer::remove_primitive(const Primitive* primitive)
+{
+    std::vector<std::shared_ptr<Primitive>>::iterator it =
+        std::find_if(scene.primitives.begin(), scene.primitives.end(),
+                     [primitive](const std::shared_ptr<Primitive>& candidate)
+                     {
+                         return candidate.get() == primitive;
+                     });
+
+    if(it == scene.primitives.end())
+        return;
+
+    scene.primitives.erase(it);
+    instances.erase(std::remove(instances.begin(), instances.end(), primitive), instances.end());
+    changed = true;
+}
+
+void ray_tracing::Tracer::set_transform(Instance& instance, const Transform& transform)
+{
+    instance.set_transform(transform);
+    changed = true;
+}
+
+void ray_tracing::Tracer::update()
+{
+    for(const Instance* instance : instances)
+        changed |= instance->get_group().build(scene.acceleration, *pool);
+
+    if(changed)
+        tree = build_acceleration_structure(scene.acceleration, scene.primitives, *pool);
+
+    changed = false;
 }
 
 ray_tracing::Matrix ray_tracing::Tracer::produce_picture()
 {
-    parallel_perform(&Tracer::produce_picture_helper);
-    parallel_perform(&Tracer::anti_aliasing_determinant);
-    parallel_perform(&Tracer::anti_aliasing_performer);
+    return produce_picture(Render_control()).picture;
+}
+
+ray_tracing::Render_result ray_tracing::Tracer::produce_picture(const Render_control& control)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    update();
+
+    double build_time = seconds_since(start);
+
+    //without a budget the tiles the control skips are left black rather than from the previous picture,
+    //with one the previews cover them
+    if(!control.is_adaptive())
+        for(size_t i = 0; i < matrix.height(); ++i)
+            std::fill(matrix[i].begin(), matrix[i].end(), Color::BLACK);
+
+    Render_result result = render_tiles(control, false, [](const Tile&){});
+
+    finish_statistics(start, build_time);
+
+    result.picture = matrix;
 
-    return matrix;
+    return result;
+}
+
+bool ray_tracing::Tracer::produce_picture(Picture_buffer& buffer, const Render_control& control)
+{
+    if(buffer.height() != matrix.height() || buffer.width() != matrix.width())
+        throw std::runtime_error("picture buffer doesn't fit the viewport");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    update();
+
+    double build_time = seconds_since(start);
+
+    bool complete = render_tiles(control,
+                                 true,
+                                 [this, &buffer](const Tile& tile)
+                                 {
+                                     buffer.publish(matrix, tile);
+                                 }).complete;
+
+    finish_statistics(start, build_time);
+
+    if(complete)
+        buffer.finish();
+
+    return complete;
+}
+
+void ray_tracing::Tracer::collect_statistics(bool collect)
+{
+    collecting = collect;
+    thread_counters.assign(collect ? pool->size() + 1 : 0, Render_statistics());
+}
+
+void ray_tracing::Tracer::finish_statistics(std::chrono::steady_clock::time_point start, double build_time)
+{
+    if(!collecting)
+        return;
+
+    statistics = Render_statistics();
+
+    for(Render_statistics& counters : thread_counters)
+    {
+        statistics += counters;
+        statistics.threads_num += counters.tiles != 0;
+        counters = Render_statistics();
+    }
+
+    statistics.phase_times[Render_statistics::BUILD] = build_time;
+    statistics.wall_time = seconds_since(start);
+}
+
+void ray_tracing::Tracer::write_statistics(std::ostream& stream) const
+{
+    stream << "{" << std::endl << "    \"tree\": ";
+    write_json(stream, tree->get_statistics(), 4);
+    stream << "," << std::endl << "    \"render\": ";
+    write_json(stream, statistics, 4);
+    stream << std::endl << "}" << std::endl;
 }
@@ -4,27 +4,70 @@
 #include <vector>
 #include <cstddef>
 #include <memory>
+#include <thread>
+#include <iterator>
+#include <string>
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <iostream>
 
 #include "picture.h"
 #include "primitive.h"
+#include "triangle_mesh.h"
+#include "instance.h"
 #include "geometry.h"
 #include "light.h"
-#include "kd_tree.h"
-#include "continuous_performer.h"
+#include "acceleration_structure.h"
+#include "thread_pool.h"
+#include "picture_buffer.h"
+#include "render_control.h"
+#include "render_statistics.h"
 
 namespace ray_tracing
 {
 
 class Tracer;
 
+enum class Sample_pattern {GRID, STRATIFIED, ROTATED_GRID};
+
+struct Anti_aliasing
+{
+    //GRID takes samples x samples points of a lattice shared by neighbouring pixels,
+    //STRATIFIED jitters one sample in each of samples x samples cells of the pixel,
+    //ROTATED_GRID always takes 4 samples. Samples are at least 2, the scene and the options reject fewer
+    Sample_pattern pattern;
+    size_t samples;
+    //pixels whose neighbourhood color variance exceeds the threshold are supersampled
+    double threshold;
+
+    Anti_aliasing(Sample_pattern pattern = Sample_pattern::GRID, size_t samples = 3, double threshold = 0.05)
+        : pattern(pattern), samples(samples), threshold(threshold)
+    {}
+
+    static Anti_aliasing factory(Sample_pattern pattern, size_t samples, double threshold)
+    {
+        return Anti_aliasing(pattern, samples, threshold);
+    }
+};
+
 class Scene
 {
     friend class Tracer;
+    friend class Scene_cache;
 
 private:
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::vector<Light> lights;
     Viewport viewport;
+    Acceleration acceleration = Acceleration::KD_TREE;
+    size_t tile_size = 32;
+    Anti_aliasing anti_aliasing;
+    //acceleration structure loaded from a cache together with the primitives
+    std::unique_ptr<Acceleration_structure> tree;
+    //the built acceleration structure is saved to this cache, if it is set
+    std::string cache_file;
+    uint64_t cache_key = 0;
 
     void add_primitive(const std::shared_ptr<Primitive>& shared_ptr)
     {
@@ -49,14 +92,101 @@ public:
     {
         add_primitive(std::make_shared<Sphere>(sphere));
     }
+    void add_primitive(const Triangle_mesh& mesh)
+    {
+        add_primitive(std::make_shared<Triangle_mesh>(mesh));
+    }
+    void add_primitive(const Instance& instance)
+    {
+        add_primitive(std::make_shared<Instance>(instance));
+    }
     void add_light(const Light& light)
     {
         lights.push_back(light);
     }
+    //moves the primitives out, e.g. into a group placed by instances
+    std::vector<std::shared_ptr<Primitive>> take_primitives()
+    {
+        return std::move(primitives);
+    }
+    void reserve_primitives(size_t primitives_num)
+    {
+        primitives.reserve(primitives_num);
+    }
+    //moves primitives and lights of the scene to the end of this one's
+    void append(Scene&& scene)
+    {
+        primitives.insert(primitives.end(),
+                          std::make_move_iterator(scene.primitives.begin()),
+                          std::make_move_iterator(scene.primitives.end()));
+        lights.insert(lights.end(), scene.lights.begin(), scene.lights.end());
+    }
     void set_viewport(const Viewport& viewport_)
     {
         viewport = viewport_;
     }
+    const Viewport& get_viewport() const
+    {
+        return viewport;
+    }
+    void set_acceleration(Acceleration acceleration_)
+    {
+        acceleration = acceleration_;
+    }
+    void set_tile_size(size_t tile_size_)
+    {
+        tile_size = tile_size_;
+    }
+    void set_anti_aliasing(const Anti_aliasing& anti_aliasing_)
+    {
+        anti_aliasing = anti_aliasing_;
+    }
+    const Anti_aliasing& get_anti_aliasing() const
+    {
+        return anti_aliasing;
+    }
+};
+
+//settings trading the quality of a picture for the time it takes, the default ones are the full quality
+struct Quality
+{
+    static const size_t TRACE_DEPTH = 10;
+
+    //rays traced from a pixel one after another: the primary one, then reflected or refracted ones
+    size_t trace_depth;
+    //hits of the first shadow_depth rays of such chains are tested for shadows,
+    //the further ones are lit by every light
+    size_t shadow_depth;
+    //whether the pixels are supersampled by the anti-aliasing of the scene
+    bool supersampling;
+
+    Quality(size_t trace_depth = TRACE_DEPTH, size_t shadow_depth = TRACE_DEPTH, bool supersampling = true)
+        : trace_depth(trace_depth), shadow_depth(shadow_depth), supersampling(supersampling)
+    {}
+};
+
+//picture produced under a render control
+struct Render_result
+{
+    Matrix picture;
+    //every tile is rendered at least at this quality, by squares of block x block pixels of one color,
+    //block is 1 once they are rendered pixel by pixel. Some tiles may be rendered finer
+    Quality quality;
+    size_t block;
+    //false if the control has stopped the picture before all its tiles were rendered pixel by pixel.
+    //Without a budget the rest are black, with one they are left from the previews
+    bool complete;
+};
+
+//approximation of ray differentials: the footprint of a pixel widens linearly along the ray
+struct Ray_cone
+{
+    double width, spread;
+
+    double at(double distance) const
+    {
+        return width + spread * distance;
+    }
 };
 
 //tracing is performed in assumption that all the primitves are on the opposite
@@ -64,34 +194,147 @@ public:
 class Tracer
 {
 private:
-    static const size_t TRACE_DEPTH = 10;
-    static const size_t RAYS_PER_SECOND = 30000;
-    constexpr static const double ANTI_ALIASING_BOUND = 0.05;
+    static const size_t PACKET_ROWS = 2;
+    static const size_t PACKET_COLUMNS = Ray_packet::SIZE / PACKET_ROWS;
+    //progressive pictures are previewed by blocks of COARSEST_BLOCK pixels, then of halves of it,
+    //down to FINEST_BLOCK, before the tiles are rendered fully
+    static const size_t COARSEST_BLOCK = 16;
+    static const size_t FINEST_BLOCK = 4;
+    //levels of quality a picture with a budget is refined through after the previews,
+    //each costs more than the previous one
+    static const std::array<Quality, 4> BUDGET_LEVELS;
+
+    //grid pattern samples of a tile, each of them is traced once
+    //and shared by all the pixels it lies on
+    struct Lattice
+    {
+        size_t cells, width;
+        std::vector<Color> colors;
+        std::vector<char> traced;
+    };
 
 private:
-    Kd_tree tree;
+    //declared first, as the tree is built on it. It may be shared, e.g. with the parser
+    std::shared_ptr<Thread_pool> pool;
+    std::unique_ptr<Acceleration_structure> tree;
     Matrix matrix;
-    std::vector<std::vector<char>> determinant_matrix;
     Scene scene;
-    Continuous_performer performer;
+    //instances among the primitives, their groups are checked for changes before every picture
+    //without looking through all the primitives
+    std::vector<const Instance*> instances;
+    //tiles are handed out to the threads in this order
+    std::vector<Tile> tiles;
+    //size of a pixel on the screen
+    double pixel_size;
+    //whether the primitives of the scene have changed since the tree was built
+    bool changed;
+    //quality of the picture being rendered
+    Quality quality;
+    //whether statistics are collected, every thread of the pool and the one calling it count into
+    //thread_counters[pool->worker_index()], summed into statistics when the picture is complete
+    bool collecting;
+    std::vector<Render_statistics> thread_counters;
+    Render_statistics statistics;
+    //whether the level being rendered supersamples the pixels the previous one has traced at the same depths,
+    //which are copied into reused_pixels, instead of tracing them again
+    bool reusing;
+    Matrix reused_pixels;
 
-    Color trace(const Ray& ray, size_t depth) const;
-    Light::Light_force light_force(const std::shared_ptr<Primitive>& primitive, const Ray& ray) const;
+    Color trace(const Ray& ray, const Ray_cone& cone, size_t depth) const;
+    Color shade(const Ray& ray, Hit hit, const Ray_cone& cone, size_t depth) const;
+    //traces a ray from the observer through the screen
+    Color trace_primary(const Ray& ray) const;
+    Ray_cone pixel_cone(const Ray& ray) const;
+    //lights occluded are only left out if shadows are tested
+    Light::Light_force light_force(const Hit& hit, const Ray& ray, bool shadows) const;
     Ray produce_ray(double i, double j) const;
-    void produce_picture_helper(size_t from, size_t to);
-    void anti_aliasing_determinant(size_t from, size_t to);
-    void anti_aliasing_performer(size_t from, size_t to);
+    //traces the pixel centers of the tile into colors row by row. The control is checked before every packet,
+    //returns false if it has stopped
+    bool trace_pixels(const Tile& tile, std::vector<Color>& colors, const Render_control& control) const;
+    Color supersample(const Tile& tile, size_t i, size_t j, const Color& center, Lattice& lattice) const;
+    //traces the tile and, with supersampling, supersamples its pixels with high neighbourhood variance in one pass.
+    //Returns false if the control stops it, the pixels not finished are left as they are
+    bool render_tile(const Tile& tile, const Render_control& control);
+    //traces one pixel of every block x block square of the tile and fills the square with it.
+    //The pixels traced by the previous pass, with blocks twice as large, aren't traced again.
+    //The control is checked before every row of squares, returns false if it has stopped
+    bool preview_tile(const Tile& tile, size_t block, const Render_control& control);
+    //the function returns whether it has performed the tile. Returns false if the control has stopped
+    //before all the tiles are performed
+    template<typename F>
+    bool parallel_perform(F function, const Render_control& control);
+    //renders the tiles at full quality or, if the control is adaptive, through BUDGET_LEVELS until it stops.
+    //The tiles are previewed first if previews is set or the control is adaptive, as the lowest level.
+    //Returns the level every tile is rendered at, the picture is left in the matrix
     template<typename F>
-    void parallel_perform(F function);
+    Render_result render_tiles(const Render_control& control, bool previews, F publish);
+
+    void save_cache() const;
+    //remembers the primitive if it is an instance
+    void add_instance(const Primitive* primitive);
+    //refits the groups changed and builds the tree again if anything has changed
+    void update();
+    //sums the counters of the threads into the statistics of the picture started at start
+    void finish_statistics(std::chrono::steady_clock::time_point start, double build_time);
+
+    //tiles of at most tile_size x tile_size pixels covering the picture, in Morton order
+    static std::vector<Tile> make_tiles(size_t height, size_t width, size_t tile_size);
 
 public:
-    Tracer(Scene&& scene)
-        : tree(scene.primitives),
-          matrix(scene.viewport.height, scene.viewport.width),
-          determinant_matrix(scene.viewport.height, std::vector<char>(scene.viewport.width)),
-          scene(std::move(scene))
+    Tracer(Scene&& scene, size_t threads_num = std::thread::hardware_concurrency())
+        : Tracer(std::move(scene), std::make_shared<Thread_pool>(threads_num))
     {}
+    Tracer(Scene&& scene, const std::shared_ptr<Thread_pool>& pool)
+        : pool(pool),
+          tree(scene.tree ? std::move(scene.tree) :
+                            build_acceleration_structure(scene.acceleration, scene.primitives, *pool)),
+          scene(std::move(scene)),
+          changed(false),
+          collecting(false),
+          reusing(false)
+    {
+        for(const std::shared_ptr<Primitive>& primitive : this->scene.primitives)
+            add_instance(primitive.get());
+
+        set_viewport(this->scene.viewport);
+        save_cache();
+    }
+    //changes of the scene between pictures are applied by the next picture. Only the top level of
+    //the tree is built again, over the instances and the other primitives of the scene, while the
+    //groups changed in place are refit
     Matrix produce_picture();
+    Render_result produce_picture(const Render_control& control);
+    //renders the picture coarse to fine, publishing every tile to the buffer as it is refined,
+    //and finishes the buffer. Returns false if the control stops before the picture is complete.
+    //The buffer is to be of the size of the viewport
+    bool produce_picture(Picture_buffer& buffer, const Render_control& control = Render_control());
+    //keeps the tree, the picture is only allocated again if its size changes
+    void set_viewport(const Viewport& viewport);
+    const Viewport& get_viewport() const
+    {
+        return scene.viewport;
+    }
+    void add_primitive(const std::shared_ptr<Primitive>& primitive);
+    //does nothing if the primitive isn't in the scene
+    void remove_primitive(const Primitive* primitive);
+    void set_transform(Instance& instance, const Transform& transform);
+    const std::vector<std::shared_ptr<Primitive>>& get_primitives() const
+    {
+        return scene.primitives;
+    }
+    const Acceleration_structure::Statistics& tree_statistics() const
+    {
+        return tree->get_statistics();
+    }
+    //statistics of the pictures produced from now on are collected, which costs a little time
+    void collect_statistics(bool collect);
+    //statistics of the last picture produced while they were collected
+    const Render_statistics& get_statistics() const
+    {
+        return statistics;
+    }
+    //writes the statistics of the tree and of the last picture as a JSON object
+    void write_statistics(std::ostream& stream) const;
 };
 
 }
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cmath>
+
+#include "triangle_mesh.h"
+#include "geometry.h"
+
+ray_tracing::Box ray_tracing::Triangle_mesh::bounds(uint32_t triangle) const
+{
+    std::array<Point, 3> v = vertices(triangle);
+    Box result(v[0], v[0]);
+
+    result.extend(v[1]);
+    result.extend(v[2]);
+
+    return result;
+}
+
+std::pair<double, uint32_t> ray_tracing::Triangle_mesh::closest(const Ray& ray) const
+{
+    std::pair<double, uint32_t> result(Ray::NOWHERE, 0);
+    Ray_shear shear(ray);
+
+    for(uint32_t i = 0; i < triangles_num(); ++i)
+    {
+        double coefficient = intersect(shear, i);
+
+        if(coefficient != Ray::NOWHERE && (result.first == Ray::NOWHERE || coefficient < result.first))
+            result = std::make_pair(coefficient, i);
+    }
+
+    return result;
+}
+
+//normals are interpolated with the barycentric coordinates of the point,
+//the normal is the same as the one of a Triangle with these vertices if there are no normals
+ray_tracing::Hit ray_tracing::Triangle_mesh::hit(const Ray& ray, double coefficient, uint32_t triangle) const
+{
+    std::array<Point, 3> v = vertices(triangle);
+    const uint32_t* index = &buffers->indices[3 * triangle];
+
+    Hit result;
+
+    result.coefficient = coefficient;
+    result.point = ray.begin + ray.guiding() * coefficient;
+    result.part = triangle;
+
+    if(buffers->has_normals())
+    {
+        std::array<double, 2> barycentric = projections(v[1] - v[0], v[2] - v[0], result.point - v[0]);
+        std::array<double, 3> weights{1 - barycentric[0] - barycentric[1], barycentric[0], barycentric[1]};
+
+        result.normal = Point(0, 0, 0);
+
+        for(size_t i = 0; i < 3; ++i)
+            for(size_t axis = 0; axis < Point::AXIS_SIZE; ++axis)
+                result.normal[axis] += weights[i] * buffers->normals[axis][index[i]];
+    }
+    else
+        result.normal = cross(v[2] - v[0], v[1] - v[0]);
+
+    result.side = side(ray, result);
+
+    return result;
+}
+
+double ray_tracing::Triangle_mesh::intersect(const Ray& ray) const
+{
+    return closest(ray).first;
+}
+
+ray_tracing::Hit ray_tracing::Triangle_mesh::hit(const Ray& ray, double coefficient) const
+{
+    return hit(ray, coefficient, closest(ray).second);
+}
+
+double ray_tracing::Triangle_mesh::point(Point::Axis axis, Either either) const
+{
+    const std::vector<double>& coordinates = buffers->positions[axis];
+
+    if(either == Either::LEFTEST)
+        return *std::min_element(coordinates.begin(), coordinates.end());
+    else
+        return *std::max_element(coordinates.begin(), coordinates.end());
+}
+
+//the side is taken relatively to the plane of the triangle, not to the interpolated normal
+ray_tracing::Orientation ray_tracing::Triangle_mesh::side(const Ray& ray, const Hit& hit) const
+{
+    std::array<Point, 3> v = vertices(hit.part);
+
+    return dot(cross(v[2] - v[0], v[1] - v[0]), ray.begin - v[0]) < 0 ? Orientation::DOWN : Orientation::UP;
+}
+
+ray_tracing::Ray ray_tracing::Triangle_mesh::refract(const Ray& ray, const Hit& hit) const
+{
+    return ray_tracing::refract(ray, hit.point, hit.normal, get_refraction(hit));
+}
+
+//uvs are interpolated with the barycentric coordinates of the point, which are the uv without uvs.
+//The footprint is scaled by the number of texels per unit of length on the triangle
+ray_tracing::Color ray_tracing::Triangle_mesh::get_color(const Hit& hit) const
+{
+    if(!textured)
+        return Monochrome_primitive::get_color(hit);
+
+    std::array<Point, 3> v = vertices(hit.part);
+    const uint32_t* index = &buffers->indices[3 * hit.part];
+
+    std::array<double, 2> barycentric = projections(v[1] - v[0], v[2] - v[0], hit.point - v[0]);
+    std::array<double, 3> weights{1 - barycentric[0] - barycentric[1], barycentric[0], barycentric[1]};
+
+    std::array<std::array<double, 2>, 3> uv{{{0, 0}, {1, 0}, {0, 1}}};
+    if(buffers->has_uvs())
+        for(size_t i = 0; i < 3; ++i)
+            uv[i] = {buffers->uvs[0][index[i]], buffers->uvs[1][index[i]]};
+
+    std::array<double, 2> point_uv{0, 0};
+    for(size_t i = 0; i < 3; ++i)
+        for(size_t k = 0; k < 2; ++k)
+            point_uv[k] += weights[i] * uv[i][k];
+
+    double  texture_area = fabs((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) -
+                                (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1])) *
+                           texture.height() * texture.width(),
+            area = cross(v[1] - v[0], v[2] - v[0]).mod();
+
+    return texture.sample(point_uv, eq_zero(area) ? 0 : hit.footprint * sqrt(texture_area / area));
+}
@@ -0,0 +1,125 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <vector>
+#include <string>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include "primitive.h"
+#include "texture.h"
+#include "geometry.h"
+#include "packet.h"
+
+namespace ray_tracing
+{
+
+//vertex attributes of a mesh as structure of arrays. Normals and uvs are either empty
+//or given for every vertex, triangles are consecutive triples of indices
+struct Mesh_buffers
+{
+    std::array<std::vector<double>, Point::AXIS_SIZE> positions;
+    std::array<std::vector<float>, Point::AXIS_SIZE> normals;
+    std::array<std::vector<float>, 2> uvs;
+    std::vector<uint32_t> indices;
+    //file the mesh is loaded from, empty for the meshes built otherwise
+    std::string source;
+
+    size_t vertices_num() const
+    {
+        return positions[0].size();
+    }
+    size_t triangles_num() const
+    {
+        return indices.size() / 3;
+    }
+    bool has_normals() const
+    {
+        return !normals[0].empty();
+    }
+    bool has_uvs() const
+    {
+        return !uvs[0].empty();
+    }
+    Point position(uint32_t vertex) const
+    {
+        return Point(positions[0][vertex], positions[1][vertex], positions[2][vertex]);
+    }
+};
+
+//indexed triangles sharing their vertices. Acceleration structures reference the triangles
+//one by one through the methods taking a triangle, so there is no object per triangle.
+//Copies of a mesh share its buffers
+class Triangle_mesh : public Monochrome_primitive
+{
+private:
+    std::shared_ptr<const Mesh_buffers> buffers;
+    //used instead of the color if it isn't empty
+    Texture texture;
+    bool textured;
+
+    std::array<Point, 3> vertices(uint32_t triangle) const
+    {
+        const uint32_t* index = &buffers->indices[3 * triangle];
+
+        return {buffers->position(index[0]), buffers->position(index[1]), buffers->position(index[2])};
+    }
+    //closest triangle and its coefficient, Ray::NOWHERE if there is none
+    std::pair<double, uint32_t> closest(const Ray& ray) const;
+
+public:
+    Triangle_mesh(const std::shared_ptr<const Mesh_buffers>& buffers, const Surface<Color>& surface)
+        : Monochrome_primitive(surface), buffers(buffers), textured(false)
+    {}
+    Triangle_mesh(const std::shared_ptr<const Mesh_buffers>& buffers, const Surface<Texture>& surface)
+        : Monochrome_primitive(Surface<Color>(Color(1, 1, 1), surface.alpha, surface.transparency, surface.refraction)),
+          buffers(buffers),
+          texture(surface.color),
+          textured(true)
+    {}
+
+    uint32_t triangles_num() const
+    {
+        return buffers->triangles_num();
+    }
+    Box bounds(uint32_t triangle) const;
+    double intersect(const Ray_shear& shear, uint32_t triangle) const
+    {
+        std::array<Point, 3> v = vertices(triangle);
+
+        return triangle_coefficient(shear, v[0], v[1], v[2]);
+    }
+    void intersect(const Ray_packet& packet, Ray_packet::Lanes& coefficients, uint32_t triangle) const
+    {
+        std::array<Point, 3> v = vertices(triangle);
+
+        triangle_coefficients(packet, v[0], v[1], v[2], coefficients);
+    }
+    virtual Hit hit(const Ray& ray, double coefficient, uint32_t triangle) const override;
+
+    //the mesh as a whole is intersected triangle by triangle
+    virtual double intersect(const Ray& ray) const override;
+    virtual Hit hit(const Ray& ray, double coefficient) const override;
+    virtual double point(Point::Axis axis, Either either) const override;
+    virtual Orientation side(const Ray& ray, const Hit& hit) const override;
+    virtual Ray refract(const Ray& ray, const Hit& hit) const override;
+    virtual Color get_color(const Hit& hit) const override;
+
+    const std::shared_ptr<const Mesh_buffers>& get_buffers() const
+    {
+        return buffers;
+    }
+    bool is_textured() const
+    {
+        return textured;
+    }
+    const Texture& get_texture() const
+    {
+        return texture;
+    }
+};
+
+}
+
+#endif // TRIANGLE_MESH_H